@@ -1,10 +1,15 @@
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+
 // Simple compute kernel which computes the square of an input array
 
 const char kernelSource[] = "             \n" \
@@ -27,18 +32,255 @@ const char kernelSource[] = "             \n" \
 "}                                       \n" \
 "\n";
 
+/* Lookup benchmark, built per table size and access pattern:
+ * -DENTRIES=<power of 2> -DPATTERN=<n> -DLOOKUPS=<n> -DLOCAL_SIZE=<n>
+ * -DSTRIDE=<n>. Every work item sums LOOKUPS table entries, the same
+ * loop runs from a __constant argument, a __global buffer and a __local
+ * copy of the table. */
+const char benchSource[] = "                                  \n" \
+"#define UNIFORM 0                                             \n" \
+"#define SEQUENTIAL 1                                          \n" \
+"#define RANDOM 2                                              \n" \
+"#define STRIDED 3                                             \n" \
+"uint hash(uint x)                                             \n" \
+"{                                                             \n" \
+"   x ^= x >> 16;                                              \n" \
+"   x *= 0x7feb352du;                                          \n" \
+"   x ^= x >> 15;                                              \n" \
+"   x *= 0x846ca68bu;                                          \n" \
+"   x ^= x >> 16;                                              \n" \
+"   return x;                                                  \n" \
+"}                                                             \n" \
+"uint index(uint gid, uint group, uint k)                      \n" \
+"{                                                             \n" \
+"#if PATTERN == UNIFORM                                        \n" \
+"   uint i = group * LOOKUPS + k;                              \n" \
+"#elif PATTERN == SEQUENTIAL                                   \n" \
+"   uint i = gid + k;                                          \n" \
+"#elif PATTERN == RANDOM                                       \n" \
+"   uint i = hash(gid * LOOKUPS + k);                          \n" \
+"#else                                                         \n" \
+"   uint i = (gid + k) * STRIDE;                               \n" \
+"#endif                                                        \n" \
+"   return i & (ENTRIES - 1);                                  \n" \
+"}                                                             \n" \
+"#define SUM(table)                                            \\\n" \
+"   uint gid = get_global_id(0);                               \\\n" \
+"   uint group = get_group_id(0);                              \\\n" \
+"   float sum = 0.0f;                                          \\\n" \
+"   for (uint k = 0; k < LOOKUPS; ++k)                         \\\n" \
+"      sum += table[index(gid, group, k)];                     \\\n" \
+"   output[gid] = sum;                                         \n" \
+"__kernel void lookup_constant(                                \n" \
+"   __constant float *table,                                   \n" \
+"   __global float *output)                                    \n" \
+"{                                                             \n" \
+"   SUM(table)                                                 \n" \
+"}                                                             \n" \
+"__kernel void lookup_global(                                  \n" \
+"   __global const float *table,                               \n" \
+"   __global float *output)                                    \n" \
+"{                                                             \n" \
+"   SUM(table)                                                 \n" \
+"}                                                             \n" \
+"#ifdef HAS_LOCAL                                              \n" \
+"__kernel __attribute__((reqd_work_group_size(LOCAL_SIZE, 1, 1)))\n" \
+"void lookup_local(                                            \n" \
+"   __global const float *table,                               \n" \
+"   __global float *output)                                    \n" \
+"{                                                             \n" \
+"   __local float copy[ENTRIES];                               \n" \
+"   for (uint j = get_local_id(0); j < ENTRIES; j += LOCAL_SIZE)\n" \
+"      copy[j] = table[j];                                     \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                              \n" \
+"   SUM(copy)                                                  \n" \
+"}                                                             \n" \
+"#endif                                                        \n" \
+"\n";
+
 enum {
 	DATA_SIZE = 16,
+	/* benchmark mode */
+	BENCH_ITEMS = 1024 * 1024,
+	BENCH_LOOKUPS = 64,
+	BENCH_LOCAL_SIZE = 64,
+	BENCH_STRIDE = 16,
+	BENCH_RUNS = 5,
+	MAX_REPORTED = 16,
 };
 
+enum pattern { UNIFORM, SEQUENTIAL, RANDOM, STRIDED, PATTERNS };
+static const char *pattern_names[PATTERNS] =
+	{ "uniform", "sequential", "random", "strided" };
+
+enum space { CONSTANT, GLOBAL, LOCAL, SPACES };
+static const char *space_names[SPACES] = { "constant", "global", "local" };
+
+/* Table sizes in entries, 4 B to 64 KiB */
+static const unsigned table_entries[] =
+	{ 1, 4, 16, 64, 256, 1024, 4096, 16384 };
+
+/* Same as the kernel side hash() */
+static uint32_t hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static uint32_t lookup_index(unsigned pattern, uint32_t gid, uint32_t k,
+                             unsigned entries)
+{
+	uint32_t i;
+	switch (pattern) {
+	case UNIFORM: i = gid / BENCH_LOCAL_SIZE * BENCH_LOOKUPS + k; break;
+	case SEQUENTIAL: i = gid + k; break;
+	case RANDOM: i = hash(gid * BENCH_LOOKUPS + k); break;
+	default: i = (gid + k) * BENCH_STRIDE; break;
+	}
+	return i & (entries - 1);
+}
+
+/* Runs every table size x pattern x address space combination and
+ * reports lookups/s. Table values are small integers so the sums are
+ * exact and compared bit for bit. */
+static int run_bench(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const cl::Program::Sources &src)
+{
+	const cl_ulong max_constant =
+		devices[0].getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+	const cl_ulong local_mem = devices[0].getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	std::cout << "Max constant buffer: " << max_constant
+		<< " B, local memory: " << local_mem << " B" << std::endl;
+
+	const unsigned max_entries = table_entries[
+		sizeof(table_entries) / sizeof(table_entries[0]) - 1];
+	std::vector<float> table(max_entries);
+	for (unsigned i = 0; i < max_entries; ++i)
+		table[i] = (float)(i * 7 % 251 + 1);
+
+	std::vector<float> expected(BENCH_ITEMS), results(BENCH_ITEMS);
+	unsigned errors = 0;
+	try {
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, BENCH_ITEMS * sizeof(float));
+
+		for (unsigned t = 0; t < sizeof(table_entries) / sizeof(table_entries[0]); ++t)
+		for (unsigned p = 0; p < PATTERNS; ++p) {
+			const unsigned entries = table_entries[t];
+			const size_t bytes = entries * sizeof(float);
+			const bool has_local = bytes <= local_mem;
+			/* exactly the swept size, the __constant variant must not
+			 * get the largest table bound for every size */
+			cl::Buffer tab = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				bytes, &table[0]);
+
+			cl::Program prg(ctx, src);
+			const std::string def("-DENTRIES=" + std::to_string(entries) +
+				" -DPATTERN=" + std::to_string(p) +
+				" -DLOOKUPS=" + std::to_string((int)BENCH_LOOKUPS) +
+				" -DLOCAL_SIZE=" + std::to_string((int)BENCH_LOCAL_SIZE) +
+				" -DSTRIDE=" + std::to_string((int)BENCH_STRIDE) +
+				(has_local ? " -DHAS_LOCAL" : ""));
+			try {
+				int ret = bench::build(prg, ctx, devices, bench::build_options(def));
+				if (ret != CL_SUCCESS) {
+					std::cout <<"BUILD FAIL" << std::endl;
+				}
+			} catch (cl::Error e) {
+				std::cerr << "Build failed:\n" << e.what() << " "
+					<< e.err() << std::endl;
+				std::cerr << "BUILD LOG:\n" <<
+					prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+					<< "\nLOG DONE\n";
+				return 1;
+			}
+
+			bench::parallel_for(BENCH_ITEMS, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					float sum = 0.0f;
+					for (unsigned k = 0; k < BENCH_LOOKUPS; ++k)
+						sum += table[lookup_index(p, i, k, entries)];
+					expected[i] = sum;
+				}
+			});
+
+			for (unsigned s = 0; s < SPACES; ++s) {
+				const std::string what = std::to_string(bytes) + " B " +
+					pattern_names[p] + " " + space_names[s];
+				if ((s == CONSTANT && bytes > max_constant) ||
+				    (s == LOCAL && !has_local)) {
+					std::cout << what << ": skipped, table too large"
+						<< std::endl;
+					continue;
+				}
+				cl::Kernel kernel(prg,
+					("lookup_" + std::string(space_names[s])).c_str());
+				kernel.setArg(0, tab);
+				kernel.setArg(1, out);
+
+				const double best = bench::best_time(cmd, kernel,
+					cl::NDRange(BENCH_ITEMS),
+					cl::NDRange(BENCH_LOCAL_SIZE), BENCH_RUNS);
+				cmd.enqueueReadBuffer(out, true, 0,
+					BENCH_ITEMS * sizeof(float), &results[0]);
+				bench::report(what, (size_t)BENCH_ITEMS * BENCH_LOOKUPS,
+				              best);
+
+				unsigned wrong = 0;
+				for (unsigned i = 0; i < BENCH_ITEMS; ++i) {
+					if (results[i] == expected[i])
+						continue;
+					if (wrong++ < MAX_REPORTED)
+						std::cerr << "Incorrect element(" << i
+							<< ") " << what << " result: "
+							<< results[i] << " correct: "
+							<< expected[i] << std::endl;
+				}
+				if (wrong)
+					std::cout << "Wrong " << what << ": " << wrong
+						<< "/" << BENCH_ITEMS << std::endl;
+				errors += wrong;
+			}
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
 int main(int argc, const char*argv[])
 {
+	bench::memory_reporter memory;
+	/* --bench runs the table size/access pattern benchmark instead of
+	 * the 16 element check */
+	bool bench_mode = false;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--bench") {
+			bench_mode = true;
+		} else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+
 	unsigned char data[DATA_SIZE]; // original data set given to device
 	float results[DATA_SIZE];    // results returned from device
 
+	bench::perf::scope perf_input("input", DATA_SIZE);
         for(unsigned i = 0; i < DATA_SIZE; i++)
 	        data[i] = rand() % 4;
+	perf_input.end();
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -66,18 +308,27 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
+	if (bench_mode) {
+		bench::trace::phase("run");
+		cl::Program::Sources bench_src(1,
+			std::make_pair(benchSource, std::strlen(benchSource)));
+		return run_bench(ctx, devices, bench_src);
+	}
+
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer in(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(data), data);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
+	cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(data), data);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -93,6 +344,7 @@ int main(int argc, const char*argv[])
 	}
 
 
+	bench::trace::phase("run");
 	/* Create kernel and set arguments */
 	try {
 		cl::Kernel kernel(prg, "square");
@@ -120,6 +372,7 @@ int main(int argc, const char*argv[])
 		return 1;
 	}
 	unsigned errors = 0;
+	bench::perf::scope perf_verify("verify", DATA_SIZE);
 	for (int i = 0; i < DATA_SIZE; ++i) {
 		float result = (data[i] + 1);
 		if (result != results[i]) {
@@ -129,6 +382,7 @@ int main(int argc, const char*argv[])
 				<< " correct: " << result << std::endl;
 		}
 	}
+	perf_verify.end();
 
 	std::cout << "Wrong: " << errors << "/" << DATA_SIZE << std::endl;
 
@@ -0,0 +1,174 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Helpers shared by the batched/benchmark tests.
+ * Include after CL/cl.hpp. */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory.h"
+#include "perf.h"
+#include "trace.h"
+
+namespace bench {
+
+/* Host wall clock in seconds */
+static inline double now()
+{
+	return ::std::chrono::duration<double>(
+		::std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Device execution time of a command, the queue needs
+ * CL_QUEUE_PROFILING_ENABLE. Also adds the command to the trace. */
+static inline double event_seconds(const cl::Event &ev)
+{
+	const cl_ulong start = ev.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	const cl_ulong end = ev.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+	if (trace::enabled())
+		trace::device(trace::command_name(
+			ev.getInfo<CL_EVENT_COMMAND_TYPE>()), ev, start, end);
+	return (end - start) * 1e-9;
+}
+
+/* Best device time of runs launches of kernel, the queue needs
+ * CL_QUEUE_PROFILING_ENABLE */
+static inline double best_time(const cl::CommandQueue &cmd,
+                               const cl::Kernel &kernel,
+                               const cl::NDRange &global,
+                               const cl::NDRange &local, unsigned runs)
+{
+	double best = 0;
+	for (unsigned r = 0; r < runs; ++r) {
+		cl::Event ev;
+		cmd.enqueueNDRangeKernel(kernel, cl::NullRange, global, local,
+			NULL, &ev);
+		ev.wait();
+		const double seconds = event_seconds(ev);
+		if (r == 0 || seconds < best)
+			best = seconds;
+	}
+	return best;
+}
+
+/* Serializes error output from verification threads */
+static inline ::std::mutex &log_lock()
+{
+	static ::std::mutex lock;
+	return lock;
+}
+
+/* Calls fn(begin, end) on disjoint chunks of [0, count), one host
+ * thread per chunk. */
+template<typename F>
+static inline void parallel_for(size_t count, F fn)
+{
+	const size_t threads =
+		::std::max(1u, ::std::thread::hardware_concurrency());
+	const size_t chunk = ::std::max<size_t>(1, (count + threads - 1) / threads);
+	::std::vector< ::std::thread> pool;
+	for (size_t begin = 0; begin < count; begin += chunk)
+		pool.push_back(::std::thread([&fn](size_t b, size_t e) {
+			trace::scope span("parallel_for");
+			fn(b, e);
+		}, begin, ::std::min(count, begin + chunk)));
+	for (auto &t : pool)
+		t.join();
+}
+
+/* One line of throughput report: items/s and, if known, GB/s */
+static inline void report(const ::std::string &name, size_t items,
+                          double seconds, size_t bytes = 0)
+{
+	::std::cout << name << ": " << items << " in " << seconds * 1e3
+		<< " ms, " << items / seconds / 1e6 << " M/s";
+	if (bytes)
+		::std::cout << ", " << bytes / seconds / 1e9 << " GB/s";
+	::std::cout << ::std::endl;
+}
+
+/* Compile option sets for the option matrix, the first one is the
+ * driver default */
+static const struct {
+	const char *name;
+	const char *options;
+} option_sets[] = {
+	{ "default", "" },
+	{ "fast-relaxed-math", "-cl-fast-relaxed-math" },
+	{ "mad-enable", "-cl-mad-enable" },
+	{ "denorms-are-zero", "-cl-denorms-are-zero" },
+	{ "finite-math-only", "-cl-finite-math-only" },
+	{ "no-signed-zeros", "-cl-no-signed-zeros" },
+	{ "opt-disable", "-cl-opt-disable" },
+};
+enum { OPTION_SETS = sizeof(option_sets) / sizeof(option_sets[0]) };
+
+/* Program build options: the test's own defines followed by anything
+ * in BENCH_CL_OPTIONS, so every test can be rebuilt with e.g.
+ * BENCH_CL_OPTIONS=-cl-fast-relaxed-math */
+static inline ::std::string build_options(const ::std::string &defines = "")
+{
+	const char *extra = getenv("BENCH_CL_OPTIONS");
+	if (!extra || !*extra)
+		return defines;
+	return defines.empty() ? extra : defines + " " + extra;
+}
+
+static inline size_t round_up(size_t value, size_t multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+/* p-th percentile (0-100) of samples, nearest rank */
+static inline double percentile(::std::vector<double> samples, double p)
+{
+	if (samples.empty())
+		return 0;
+	::std::sort(samples.begin(), samples.end());
+	size_t rank = (size_t)(p / 100.0 * (samples.size() - 1) + 0.5);
+	return samples[::std::min(rank, samples.size() - 1)];
+}
+
+/* Distance of result from the exact value in units of the float ulp at
+ * reference. Matching infinities and NaNs are 0, any other non-finite
+ * mismatch is infinite. */
+static inline double ulp_error(float result, double reference)
+{
+	if (::std::isnan(reference) || ::std::isnan(result))
+		return ::std::isnan(reference) && ::std::isnan(result) ?
+			0 : INFINITY;
+	if (::std::isinf(reference) || ::std::isinf(result))
+		return (double)result == reference ? 0 : INFINITY;
+	const float rounded = ::std::fabs((float)reference);
+	const double ulp = ::std::isinf(::std::nextafter(rounded, INFINITY)) ?
+		(double)rounded - ::std::nextafter(rounded, 0.0f) :
+		(double)::std::nextafter(rounded, INFINITY) - rounded;
+	return ::std::fabs((double)result - reference) / ulp;
+}
+
+/* xorshift64*, cheap reproducible input generation */
+static inline uint64_t rand64(uint64_t &state)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform float in [0, 1) */
+static inline float randf(uint64_t &state)
+{
+	return (rand64(state) >> 40) * (1.0f / (1 << 24));
+}
+
+}
+
+#endif
@@ -1,11 +1,18 @@
 #include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+#include "golden.h"
+#include "repro.h"
+
 #define VECTOR
 
 // Simple compute kernel which computes the square of an input array
@@ -52,22 +59,338 @@ static unsigned to_uint(float num)
 	return conv.u;
 }
 
-float data1[DATA_SIZE];       // original data set given to device
-float data2[DATA_SIZE];       // original data set given to device
-float results[DATA_SIZE];    // results returned from device
-float results2[DATA_SIZE];   // results returned from device
+/* One chunk of DATA_SIZE, see bench::fit_elements */
+std::vector<float> data1;       // original data set given to device
+std::vector<float> data2;       // original data set given to device
+std::vector<float> results;    // results returned from device
+std::vector<float> results2;   // results returned from device
 
-int main(int argc, const char*argv[])
+/* One failing element, see repro.h */
+struct fmin_repro {
+	uint64_t index;
+	float a, b;
+	float result, result2;
+};
+
+/* Runs both kernels over the first count elements of the host arrays,
+ * count is a multiple of 4 */
+static void run_device(const cl::CommandQueue &cmd, const cl::Kernel &kernel,
+                       const cl::Kernel &kernel2, const cl::Buffer &in1,
+                       const cl::Buffer &in2, const cl::Buffer &out,
+                       const cl::Buffer &out2, size_t count)
+{
+	cmd.enqueueWriteBuffer(in1, false, 0, count * sizeof(float), &data1[0]);
+	cmd.enqueueWriteBuffer(in2, false, 0, count * sizeof(float), &data2[0]);
+	cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0), cl::NDRange(count), cl::NDRange(1));
+	cmd.finish();
+	cmd.enqueueReadBuffer(out, true, 0, count * sizeof(float), &results[0], 0);
+#ifdef VECTOR
+	cmd.enqueueNDRangeKernel(kernel2, cl::NDRange(0), cl::NDRange(count / 4), cl::NDRange(1));
+	cmd.finish();
+	cmd.enqueueReadBuffer(out2, true, 0, count * sizeof(float), &results2[0], 0);
+#else
+	(void)kernel2;
+	(void)out2;
+#endif
+}
+
+/* Inputs of elements [base, base + count) into data1/data2. data2 comes
+ * from rand(), the caller restarts it with srand(1) for a new pass. */
+static void fill_inputs(size_t base, size_t count)
+{
+	for (size_t j = 0; j < count; ++j) {
+		const unsigned i = base + j;
+		data1[j] = to_float(((i << 8) & 0x8000000) | 0x7f800000 | (i & 0x7fffff));
+		data2[j] = rand() / (float)RAND_MAX;
+	}
+}
+
+/* Host reference of data1/data2 elements [begin, end) */
+static void reference(float *ref, size_t begin, size_t end)
+{
+	for (size_t j = begin; j < end; ++j)
+		ref[j] = fmin(data1[j], data2[j]);
+}
+
+enum {
+	BISECT_QUEUES = 4,
+	BISECT_LAUNCHES = 4096,   // split no further after this many
+	MAX_REPORTED = 16,
+	MATRIX_RUNS = 5,
+};
+
+/* Launch window in work items */
+struct window {
+	size_t offset;
+	size_t size;
+	bool failed;
+	bool dense;     // every element wrong or the launch failed
+	double seconds;
+};
+
+/* Launches every window with its global offset, round robin over the
+ * queues, and marks the ones that failed to run or left a wrong element.
+ * A work item covers width elements of out. */
+static void run_windows(const std::vector<cl::CommandQueue> &queues,
+                        const cl::Kernel &kernel, const cl::Buffer &out,
+                        std::vector<float> &res, unsigned width,
+                        const float *expected, std::vector<window> &windows)
+{
+	/* elements no launch wrote stay NaN with a non canonical payload */
+	queues[0].enqueueFillBuffer(out, 0xffffffffu, 0, res.size() * sizeof(float));
+	queues[0].finish();
+
+	std::vector<cl::Event> events(windows.size());
+	for (size_t w = 0; w < windows.size(); ++w) {
+		const cl::CommandQueue &q = queues[w % queues.size()];
+		window &win = windows[w];
+		win.failed = win.dense = false;
+		win.seconds = 0;
+		try {
+			q.enqueueNDRangeKernel(kernel, cl::NDRange(win.offset),
+				cl::NDRange(win.size), cl::NDRange(1), NULL,
+				&events[w]);
+			q.enqueueReadBuffer(out, false,
+				win.offset * width * sizeof(float),
+				win.size * width * sizeof(float),
+				&res[win.offset * width]);
+		} catch (cl::Error e) {
+			win.failed = win.dense = true;
+		}
+	}
+	for (const cl::CommandQueue &q:queues)
+		q.finish();
+
+	for (size_t w = 0; w < windows.size(); ++w) {
+		window &win = windows[w];
+		if (win.failed)
+			continue;
+		win.seconds = bench::event_seconds(events[w]);
+		size_t wrong = 0;
+		for (size_t j = win.offset * width;
+		     j < (win.offset + win.size) * width; ++j)
+			wrong += to_uint(expected[j]) != to_uint(res[j]);
+		win.failed = wrong != 0;
+		win.dense = wrong == win.size * width;
+	}
+}
+
+/* Halves failing windows until both halves of a window pass, both fail
+ * everywhere or it is a single work item, and reports those minimal
+ * failing windows. Dense failures stop after one split, and no level is
+ * started past BISECT_LAUNCHES launches. */
+static void bisect(const std::vector<cl::CommandQueue> &queues,
+                     const cl::Kernel &kernel, const cl::Buffer &out,
+                     std::vector<float> &res, unsigned width, size_t items,
+                     size_t base, const float *expected, const char *name)
 {
-	(void) argc;
-	(void) argv;
+	const double start = bench::now();
+	std::vector<window> level(1);
+	level[0].offset = 0;
+	level[0].size = items;
+	run_windows(queues, kernel, out, res, width, expected, level);
+	unsigned launches = 1;
 
+	std::vector<window> minimal;
+	while (!level.empty()) {
+		std::vector<window> parents, halves;
+		for (const window &w:level) {
+			if (!w.failed)
+				continue;
+			if (w.size == 1) {
+				minimal.push_back(w);
+				continue;
+			}
+			window half = w;
+			half.size = w.size / 2;
+			parents.push_back(w);
+			halves.push_back(half);
+			half.offset += half.size;
+			half.size = w.size - half.size;
+			halves.push_back(half);
+		}
+		if (halves.empty())
+			break;
+		if (launches + halves.size() > BISECT_LAUNCHES) {
+			std::cout << "Bisect " << name << ": " << parents.size()
+				<< " windows not split, launch limit reached"
+				<< std::endl;
+			minimal.insert(minimal.end(), parents.begin(),
+			               parents.end());
+			break;
+		}
+		run_windows(queues, kernel, out, res, width, expected, halves);
+		launches += halves.size();
+		level.clear();
+		for (size_t p = 0; p < parents.size(); ++p) {
+			const window &lo = halves[2 * p], &hi = halves[2 * p + 1];
+			/* the failure needs the whole parent window, or it
+			 * covers all of it and splitting finds nothing new */
+			if ((!lo.failed && !hi.failed) || (lo.dense && hi.dense)) {
+				window w = parents[p];
+				w.dense |= lo.dense && hi.dense;
+				minimal.push_back(w);
+				continue;
+			}
+			level.push_back(lo);
+			level.push_back(hi);
+		}
+	}
 
-        for(unsigned i = 0; i < DATA_SIZE; i++) {
-	        data1[i] = to_float(((i << 8) & 0x8000000) | 0x7f800000 | (i & 0x7fffff));
-	        data2[i] = rand() / (float)RAND_MAX;
+	for (size_t m = 0; m < minimal.size() && m < MAX_REPORTED; ++m) {
+		const window &w = minimal[m];
+		std::cout << "Bisect " << name << ": elements "
+			<< base + w.offset * width << ".."
+			<< base + (w.offset + w.size) * width - 1
+			<< " (offset " << w.offset << ", size " << w.size
+			<< ") fail" << (w.dense ? " everywhere" : "") << ", "
+			<< w.seconds * 1e3 << " ms" << std::endl;
 	}
+	if (minimal.size() > MAX_REPORTED)
+		std::cout << "Bisect " << name << ": "
+			<< minimal.size() - MAX_REPORTED << " more windows"
+			<< std::endl;
+	std::cout << "Bisect " << name << ": " << minimal.size()
+		<< " minimal failing windows, " << launches << " launches on "
+		<< queues.size() << " queues in "
+		<< (bench::now() - start) * 1e3 << " ms" << std::endl;
+}
+
+/* The whole DATA_SIZE check once per compile option set, in chunks like
+ * the default run, and a table of wrong elements per set. Most inputs
+ * are infinities and NaNs, which the finite math options let the
+ * compiler ignore. */
+static int run_matrix(const cl::Context &ctx,
+                      const cl::vector<cl::Device> &devices)
+{
+	const size_t chunk = bench::fit_elements(devices[0], DATA_SIZE,
+		4 * sizeof(float), sizeof(float), 4 * sizeof(float), 4);
+	data1.resize(chunk);
+	data2.resize(chunk);
+	results.resize(chunk);
+	results2.resize(chunk);
+	const size_t bytes = chunk * sizeof(float);
+	cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY, bytes);
+	cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY, bytes);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+	cl::Buffer out2 = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 
+	std::vector<std::string> summary;
+	int ret = 0;
+	for (unsigned o = 0; o < bench::OPTION_SETS; ++o) {
+		std::cout << "Options: " << bench::option_sets[o].name << std::endl;
+		const std::string name = bench::option_sets[o].name;
+		cl::Program prg(ctx, src);
+		cl::Kernel kernel, kernel2;
+		cl::CommandQueue cmd;
+		try {
+			bench::build(prg, ctx, devices,
+				bench::build_options(bench::option_sets[o].options));
+			kernel = cl::Kernel(prg, "fmin_test");
+			kernel.setArg(0, in1);
+			kernel.setArg(1, in2);
+			kernel.setArg(2, out);
+#ifdef VECTOR
+			kernel2 = cl::Kernel(prg, "fmin_vec_test");
+			kernel2.setArg(0, in1);
+			kernel2.setArg(1, in2);
+			kernel2.setArg(2, out2);
+#endif
+			cmd = cl::CommandQueue(ctx, devices[0],
+			                       CL_QUEUE_PROFILING_ENABLE);
+		} catch (cl::Error e) {
+			std::cerr << "Build failed:\n" << e.what() << " "
+				<< e.err() << std::endl;
+			std::cerr << "BUILD LOG:\n" <<
+				prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+				<< "\nLOG DONE\n";
+			summary.push_back(name + ", build failed");
+			if (o == 0)
+				ret = 1;
+			continue;
+		}
+
+		/* same inputs as the default run, golden cache included */
+		srand(1);
+		unsigned errors1 = 0, errors2 = 0;
+		double seconds1 = 0, seconds2 = 0;
+		bool failed = false;
+		for (size_t base = 0; base < DATA_SIZE && !failed; base += chunk) {
+			const size_t count = std::min<size_t>(chunk, DATA_SIZE - base);
+			fill_inputs(base, count);
+			try {
+				run_device(cmd, kernel, kernel2, in1, in2, out, out2,
+				           count);
+				/* the inputs are still on the device */
+				seconds1 += bench::best_time(cmd, kernel,
+					cl::NDRange(count), cl::NDRange(1), MATRIX_RUNS);
+#ifdef VECTOR
+				seconds2 += bench::best_time(cmd, kernel2,
+					cl::NDRange(count / 4), cl::NDRange(1), MATRIX_RUNS);
+#endif
+			} catch (cl::Error e) {
+				std::cerr << "Kernel failed: " << e.what() << " "
+					<< e.err() << std::endl;
+				failed = true;
+				break;
+			}
+			bench::golden<float> golden("fmin", "fmin", 1, base, count);
+			const float *expected = golden.get(reference);
+			for (size_t j = 0; j < count; ++j) {
+				errors1 += to_uint(expected[j]) != to_uint(results[j]);
+#ifdef VECTOR
+				errors2 += to_uint(expected[j]) != to_uint(results2[j]);
+#endif
+			}
+		}
+		if (failed) {
+			summary.push_back(name + ", kernel failed");
+			if (o == 0)
+				ret = 1;
+			continue;
+		}
+		summary.push_back(name + ", " + std::to_string(errors1) + ", " +
+			std::to_string(errors2) + ", " +
+			std::to_string(seconds1 ? DATA_SIZE / seconds1 / 1e6 : 0) +
+			", " +
+			std::to_string(seconds2 ? DATA_SIZE / seconds2 / 1e6 : 0));
+	}
+	std::cout << "options, wrong scalar, wrong vector of " << DATA_SIZE
+		<< ", M/s scalar, M/s vector" << std::endl;
+	for (const std::string &row:summary)
+		std::cout << row << std::endl;
+	return ret;
+}
+
+int main(int argc, const char*argv[])
+{
+	bench::memory_reporter memory;
+	/* --matrix runs the check once per compile option set */
+	const char *replay = NULL;
+	bool bisect_mode = false, matrix = false;
+	for (int i = 1; i < argc; ++i) {
+		if (!strncmp(argv[i], "--replay=", 9)) {
+			replay = argv[i] + 9;
+		} else if (!strcmp(argv[i], "--bisect")) {
+			bisect_mode = true;
+		} else if (!strcmp(argv[i], "--matrix")) {
+			matrix = true;
+		} else {
+			std::cerr << "Unknown argument: " << argv[i] << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<fmin_repro> records;
+	if (replay && !bench::load_repro(replay, "fmin", records))
+		return 1;
+	if (replay && records.empty()) {
+		std::cout << "Replay: no elements in " << replay << std::endl;
+		return 0;
+	}
+
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -95,20 +418,21 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
-	/* CL buffers to use as kernel arguments */
-	cl::Buffer in1(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data1), data1);
-	cl::Buffer in2(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data2), data2);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
-	cl::Buffer out2(ctx, CL_MEM_WRITE_ONLY, sizeof(results2));
+	if (matrix) {
+		bench::trace::phase("run");
+		return run_matrix(ctx, devices);
+	}
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -124,9 +448,33 @@ int main(int argc, const char*argv[])
 	}
 
 
+	/* Two inputs and two outputs per element on both sides, chunks
+	 * stay a multiple of the vector width */
+	const size_t total = replay ? bench::round_up(records.size(), 4) : (size_t)DATA_SIZE;
+	const size_t chunk = bench::fit_elements(devices[0], total,
+		4 * sizeof(float), sizeof(float), 4 * sizeof(float), 4);
+	if (chunk < total)
+		std::cout << "Running in chunks of " << chunk << " elements"
+			<< std::endl;
+	data1.resize(chunk);
+	data2.resize(chunk);
+	results.resize(chunk);
+	results2.resize(chunk);
+	const size_t bytes = chunk * sizeof(float);
+
+	/* CL buffers to use as kernel arguments */
+	cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY, bytes);
+	cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY, bytes);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+	cl::Buffer out2 = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+
+	bench::trace::phase("run");
 	/* Create kernel and set arguments */
+	cl::Kernel kernel, kernel2;
+	cl::CommandQueue cmd;
+	std::vector<cl::CommandQueue> queues;
 	try {
-		cl::Kernel kernel(prg, "fmin_test");
+		kernel = cl::Kernel(prg, "fmin_test");
 		kernel.setArg(0, in1);
 		kernel.setArg(1, in2);
 		kernel.setArg(2, out);
@@ -135,52 +483,149 @@ int main(int argc, const char*argv[])
 		cl::size_t<3> local;                // local domain size for our calculation
 		kernel.getWorkGroupInfo(devices[0], CL_KERNEL_COMPILE_WORK_GROUP_SIZE, &local);
 		std::cout << "Local size is: " << local[2] << std::endl;
-
-		/* Command queue */
-		cl::CommandQueue cmd(ctx, devices[0]);
-
-		cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0), cl::NDRange(DATA_SIZE), cl::NDRange(1));
-		cmd.finish();
-		cmd.enqueueReadBuffer(out, true, 0, sizeof(results), results, 0);
 #ifdef VECTOR
 		/* test vector fmin */
-		cl::Kernel kernel2(prg, "fmin_vec_test");
+		kernel2 = cl::Kernel(prg, "fmin_vec_test");
 		kernel2.setArg(0, in1);
 		kernel2.setArg(1, in2);
 		kernel2.setArg(2, out2);
+#endif
 
 		/* Command queue */
-		cmd.enqueueNDRangeKernel(kernel2, cl::NDRange(0), cl::NDRange(DATA_SIZE / 4), cl::NDRange(1));
-		cmd.finish();
-		cmd.enqueueReadBuffer(out2, true, 0, sizeof(results2), results2, 0);
-#endif
+		cmd = cl::CommandQueue(ctx, devices[0]);
+		/* bisect launches go to several queues at once */
+		for (unsigned q = 0; bisect_mode && q < BISECT_QUEUES; ++q)
+			queues.push_back(cl::CommandQueue(ctx, devices[0],
+				CL_QUEUE_PROFILING_ENABLE));
 	} catch (cl::Error e) {
 		std::cerr << "Kernel failed: " << e.what() << " "
 			<< e.err() << std::endl;
 		return 1;
-	} catch (...) {
-		return 1;
 	}
-	unsigned errors1 = 0, errors2 = 0;
-	for (int i = 0; i < DATA_SIZE; ++i) {
-		float result = fmin(data1[i], data2[i]);
-		if (to_uint(result) != to_uint(results[i])) {
-			++errors1;
-			std::cerr << "Incorrect element(" << i << "): "
-				<< data1[i] << ", " << data2[i] << " result: "
-				<< results[i] << " correct: " << result
-				<< std::endl;
+
+	if (replay) {
+		/* Failing elements only, the vector kernel sees other
+		 * neighbours than in the full run */
+		unsigned failing = 0;
+		const double start = bench::now();
+		for (size_t base = 0; base < records.size(); base += chunk) {
+			const size_t count = std::min(chunk, records.size() - base);
+			for (size_t j = 0; j < bench::round_up(count, 4); ++j) {
+				const fmin_repro &r = records[base + std::min(j, count - 1)];
+				data1[j] = r.a;
+				data2[j] = r.b;
+			}
+			try {
+				run_device(cmd, kernel, kernel2, in1, in2, out, out2,
+				           bench::round_up(count, 4));
+			} catch (cl::Error e) {
+				std::cerr << "Kernel failed: " << e.what() << " "
+					<< e.err() << std::endl;
+				return 1;
+			}
+			for (size_t j = 0; j < count; ++j) {
+				const fmin_repro &r = records[base + j];
+				const float result = fmin(r.a, r.b);
+				bool fail = to_uint(result) != to_uint(results[j]);
+#ifdef VECTOR
+				fail |= to_uint(result) != to_uint(results2[j]);
+#endif
+				failing += fail;
+				std::cerr << (fail ? "Incorrect" : "Fixed")
+					<< " element(" << r.index << "): " << r.a
+					<< ", " << r.b << " was: " << r.result
+					<< ", " << r.result2 << " result: "
+					<< results[j] << ", " << results2[j]
+					<< " correct: " << result << std::endl;
+			}
 		}
+		std::cout << "Replay: " << failing << "/" << records.size()
+			<< " still wrong in " << (bench::now() - start) * 1e3
+			<< " ms" << std::endl;
+		/* scripted driver bisects go by the exit code */
+		return failing ? 1 : 0;
+	}
+
+	unsigned errors1 = 0, errors2 = 0;
+	bench::repro_writer<fmin_repro> repro("fmin");
+	for (size_t base = 0; base < DATA_SIZE; base += chunk) {
+		const size_t count = std::min<size_t>(chunk, DATA_SIZE - base);
+		bench::trace::phase("input");
+		bench::perf::scope perf_input("input", count);
+		fill_inputs(base, count);
+		perf_input.end();
+
+		if (bisect_mode) {
+			bench::trace::phase("bisect");
+			bench::golden<float> golden("fmin", "fmin", 1, base, count);
+			const float *expected = golden.get(reference);
+			try {
+				cmd.enqueueWriteBuffer(in1, false, 0, count * sizeof(float), &data1[0]);
+				cmd.enqueueWriteBuffer(in2, true, 0, count * sizeof(float), &data2[0]);
+				bisect(queues, kernel, out, results, 1, count, base,
+				       expected, "fmin_test");
 #ifdef VECTOR
-		if (to_uint(result) != to_uint(results2[i])) {
-			++errors2;
-			std::cerr << "Incorrect element2(" << i << "): "
-				<< data1[i] << ", " << data2[i] << " result: "
-				<< results2[i] << " correct: " << result
-				<< std::endl;
+				bisect(queues, kernel2, out2, results2, 4, count / 4,
+				       base, expected, "fmin_vec_test");
+#endif
+			} catch (cl::Error e) {
+				std::cerr << "Kernel failed: " << e.what() << " "
+					<< e.err() << std::endl;
+				return 1;
+			}
+			continue;
 		}
+
+		bench::trace::phase("run");
+		try {
+			run_device(cmd, kernel, kernel2, in1, in2, out, out2, count);
+		} catch (cl::Error e) {
+			std::cerr << "Kernel failed: " << e.what() << " "
+				<< e.err() << std::endl;
+			return 1;
+		} catch (...) {
+			return 1;
+		}
+
+		bench::trace::phase("verify");
+		bench::perf::scope perf_verify("verify", count);
+		/* inputs come from the index and rand() with the default seed */
+		bench::golden<float> golden("fmin", "fmin", 1, base, count);
+		const float *expected = golden.get(reference);
+		for (size_t j = 0; j < count; ++j) {
+			const size_t i = base + j;
+			float result = expected[j];
+			bool fail = false;
+			if (to_uint(result) != to_uint(results[j])) {
+				fail = true;
+				++errors1;
+				std::cerr << "Incorrect element(" << i << "): "
+					<< data1[j] << ", " << data2[j] << " result: "
+					<< results[j] << " correct: " << result
+					<< std::endl;
+			}
+#ifdef VECTOR
+			if (to_uint(result) != to_uint(results2[j])) {
+				fail = true;
+				++errors2;
+				std::cerr << "Incorrect element2(" << i << "): "
+					<< data1[j] << ", " << data2[j] << " result: "
+					<< results2[j] << " correct: " << result
+					<< std::endl;
+			}
 #endif
+			if (fail) {
+				const fmin_repro r = { i, data1[j], data2[j],
+				                       results[j], results2[j] };
+				repro.add(r);
+			}
+		}
+		perf_verify.end();
 	}
+	/* bisect adds no records, saving would remove the repro file */
+	if (bisect_mode)
+		return 0;
+	repro.save();
 
 	std::cout << "Wrong1: " << errors1 << "/" << DATA_SIZE << std::endl;
 #ifdef VECTOR
@@ -0,0 +1,148 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+/* Cache of host reference results, enabled with BENCH_REF_CACHE=<dir>.
+ * A reference depends only on the test, kernel, input seed and range, so
+ * it is computed once and stored in <dir>/<test>-<key hash>.ref: a
+ * golden_header followed by the expected values. Later runs map the file
+ * read only and verification streams through the mapped pages. Files
+ * with another version, key, size or checksum are recomputed and
+ * replaced. Inputs from rand() are only reproducible with the same libc,
+ * keep the directory local to the machine. Include after program.h. */
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+enum {
+	/* bump when the layout or a reference function changes */
+	GOLDEN_VERSION = 1,
+};
+
+struct golden_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t elem_size;
+	uint64_t count;
+	uint64_t key;
+	uint64_t checksum;
+};
+
+static const char golden_magic[8] = { 'B', 'E', 'N', 'C', 'H', 'R', 'E', 'F' };
+
+/* FNV style hash over 64-bit words, eight times fewer steps than fnv1a64
+ * on the multi-MB references */
+static inline uint64_t golden_checksum(const char *data, size_t bytes)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ULL;
+		hash ^= hash >> 29;
+	}
+	for (; i < bytes; ++i)
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+	return hash;
+}
+
+/* Expected values of count elements starting at element first */
+template<typename T>
+class golden {
+public:
+	golden(const char *test, const ::std::string &kernel, uint64_t seed,
+	       size_t first, size_t count)
+		: test(test), count(count)
+	{
+		char buf[128];
+		snprintf(buf, sizeof(buf), "/%llx/%zu/%zu/%zu",
+		         (unsigned long long)seed, first, count, sizeof(T));
+		key = fnv1a64(::std::string(test) + "/" + kernel + buf);
+	}
+
+	/* fill(out, begin, end) computes out[begin, end) when there is no
+	 * valid cache file, it runs on parallel_for threads */
+	template<typename F>
+	const T *get(F fill)
+	{
+		const char *dir = getenv("BENCH_REF_CACHE");
+		::std::string path;
+		if (dir) {
+			char name[32];
+			snprintf(name, sizeof(name), "-%016llx.ref",
+			         (unsigned long long)key);
+			path = ::std::string(dir) + "/" + test + name;
+			file.reset(new mapped_file(path));
+			if (valid())
+				return (const T *)(file->data() +
+				                   sizeof(golden_header));
+			file.reset();
+		}
+		values.resize(count ? count : 1);
+		parallel_for(count, [&](size_t begin, size_t end) {
+			fill(&values[0], begin, end);
+		});
+		if (dir)
+			store(path);
+		return &values[0];
+	}
+
+	/* True if the last get() came from the cache file */
+	bool cached() const { return file.get() != NULL; }
+private:
+	golden(const golden &);
+	golden &operator=(const golden &);
+
+	bool valid() const
+	{
+		if (!file->ok() || file->size() != sizeof(golden_header) +
+		    count * sizeof(T))
+			return false;
+		golden_header h;
+		memcpy(&h, file->data(), sizeof(h));
+		return !memcmp(h.magic, golden_magic, sizeof(h.magic)) &&
+			h.version == GOLDEN_VERSION &&
+			h.elem_size == sizeof(T) && h.count == count &&
+			h.key == key &&
+			h.checksum == golden_checksum(file->data() + sizeof(h),
+			                              count * sizeof(T));
+	}
+
+	void store(const ::std::string &path) const
+	{
+		golden_header h;
+		memcpy(h.magic, golden_magic, sizeof(h.magic));
+		h.version = GOLDEN_VERSION;
+		h.elem_size = sizeof(T);
+		h.count = count;
+		h.key = key;
+		h.checksum = golden_checksum((const char *)&values[0],
+		                             count * sizeof(T));
+		const ::std::string tmp = path + ".tmp";
+		FILE *f = fopen(tmp.c_str(), "wb");
+		if (!f) {
+			perror(tmp.c_str());
+			return;
+		}
+		bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+		ok = ok && (!count ||
+		            fwrite(&values[0], sizeof(T), count, f) == count);
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+			unlink(tmp.c_str());
+	}
+
+	const char *test;
+	size_t count;
+	uint64_t key;
+	::std::unique_ptr<mapped_file> file;
+	::std::vector<T> values;
+};
+
+}
+
+#endif
@@ -1,10 +1,16 @@
+#include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+
 // Simple compute kernel which computes the square of an input array
 
 const char kernelSource[] = "             \n" \
@@ -29,24 +35,851 @@ const char kernelSource[] = "             \n" \
 "                                        \n" \
 "   output[i] = (float2) (y, in.y);      \n" \
 "}                                       \n" \
+"                                        \n" \
+"/* 2D version for pitched images */      \n" \
+"__kernel void contrast_2d(              \n" \
+"   __global const float2 *input,        \n" \
+"   __global       float2 *output,       \n" \
+"   __global const float  *curve,        \n" \
+"                  int samples,          \n" \
+"                  int width,            \n" \
+"                  int height,           \n" \
+"                  int pitch)            \n" \
+"{                                       \n" \
+"   int px = get_global_id(0);           \n" \
+"   int py = get_global_id(1);           \n" \
+"   if (px >= width || py >= height)     \n" \
+"      return;                           \n" \
+"   size_t i = (size_t)py * pitch + px;  \n" \
+"   float2 in = input[i];                \n" \
+"   int x = in.x * samples;              \n" \
+"   float y;                             \n" \
+"   if (x < 0)                           \n" \
+"      y = curve[0];                     \n" \
+"   else if (x < samples)                \n" \
+"      y = curve[x];                     \n" \
+"   else                                 \n" \
+"      y = curve[samples -1];            \n" \
+"                                        \n" \
+"   output[i] = (float2) (y, in.y);      \n" \
+"}                                       \n" \
+"\n";
+
+/* contrast through images: every RGBA float texel of the input holds
+ * two (value, passthrough) pixels, the curve is a 1D image. The nearest
+ * variant matches the buffer kernel, the linear one lets the sampler
+ * interpolate between curve points. */
+const char imageSource[] = "             \n" \
+"__constant sampler_t pixel_sampler = CLK_NORMALIZED_COORDS_FALSE |   \n" \
+"   CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;                   \n" \
+"__constant sampler_t curve_nearest = CLK_NORMALIZED_COORDS_FALSE |   \n" \
+"   CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;                   \n" \
+"__constant sampler_t curve_linear = CLK_NORMALIZED_COORDS_TRUE |     \n" \
+"   CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;                    \n" \
+"                                        \n" \
+"__kernel void contrast_image(           \n" \
+"   __read_only image2d_t input,         \n" \
+"   __write_only image2d_t output,       \n" \
+"   __read_only image1d_t curve,         \n" \
+"                  int samples)          \n" \
+"{                                       \n" \
+"   int2 pos = (int2)(get_global_id(0), get_global_id(1)); \n" \
+"   float4 in = read_imagef(input, pixel_sampler, pos);    \n" \
+"   float y0 = read_imagef(curve, curve_nearest, in.x * samples).x; \n" \
+"   float y1 = read_imagef(curve, curve_nearest, in.z * samples).x; \n" \
+"   write_imagef(output, pos, (float4) (y0, in.y, y1, in.w));       \n" \
+"}                                       \n" \
+"                                        \n" \
+"__kernel void contrast_image_linear(    \n" \
+"   __read_only image2d_t input,         \n" \
+"   __write_only image2d_t output,       \n" \
+"   __read_only image1d_t curve,         \n" \
+"                  int samples)          \n" \
+"{                                       \n" \
+"   int2 pos = (int2)(get_global_id(0), get_global_id(1)); \n" \
+"   float4 in = read_imagef(input, pixel_sampler, pos);    \n" \
+"   /* texel centers sit at (i + 0.5) / samples */          \n" \
+"   float scale = (samples - 1.0f) / samples;               \n" \
+"   float bias = 0.5f / samples;                            \n" \
+"   float y0 = read_imagef(curve, curve_linear, in.x * scale + bias).x; \n" \
+"   float y1 = read_imagef(curve, curve_linear, in.z * scale + bias).x; \n" \
+"   write_imagef(output, pos, (float4) (y0, in.y, y1, in.w));       \n" \
+"}                                       \n" \
+"\n";
+
+/* contrast with the curve in __constant, __global or staged into
+ * __local per work-group, each with nearest lookup (like contrast) or
+ * linear interpolation between curve points. Work items stride over
+ * the pixels so that the __local copy is amortized. */
+const char lutSource[] = "             \n" \
+"#define LUT(space)                                                   \\\n" \
+"float space##_nearest(space const float *curve, float v, int samples)\\\n" \
+"{                                                                    \\\n" \
+"   int x = v * samples;                                              \\\n" \
+"   return curve[clamp(x, 0, samples - 1)];                           \\\n" \
+"}                                                                    \\\n" \
+"float space##_linear(space const float *curve, float v, int samples) \\\n" \
+"{                                                                    \\\n" \
+"   float t = clamp(v, 0.0f, 1.0f) * (samples - 1);                   \\\n" \
+"   int x = min((int)t, samples - 2);                                 \\\n" \
+"   return curve[x] + (curve[x + 1] - curve[x]) * (t - x);            \\\n" \
+"}                                                                    \n" \
+"LUT(__constant)                                                      \n" \
+"LUT(__global)                                                        \n" \
+"LUT(__local)                                                         \n" \
+"                                                                     \n" \
+"#define DIRECT(name, space, lookup)                                  \\\n" \
+"__kernel void name(__global const float2 *input,                     \\\n" \
+"                   __global float2 *output,                          \\\n" \
+"                   space const float *curve,                         \\\n" \
+"                   int samples, unsigned count)                      \\\n" \
+"{                                                                    \\\n" \
+"   for (size_t i = get_global_id(0); i < count; i += get_global_size(0)) { \\\n" \
+"      float2 in = input[i];                                          \\\n" \
+"      output[i] = (float2) (lookup(curve, in.x, samples), in.y);     \\\n" \
+"   }                                                                 \\\n" \
+"}                                                                    \n" \
+"DIRECT(contrast_constant, __constant, __constant_nearest)            \n" \
+"DIRECT(contrast_constant_linear, __constant, __constant_linear)      \n" \
+"DIRECT(contrast_global, __global, __global_nearest)                  \n" \
+"DIRECT(contrast_global_linear, __global, __global_linear)            \n" \
+"                                                                     \n" \
+"#define STAGED(name, lookup)                                         \\\n" \
+"__kernel void name(__global const float2 *input,                     \\\n" \
+"                   __global float2 *output,                          \\\n" \
+"                   __global const float *curve,                      \\\n" \
+"                   int samples, unsigned count,                      \\\n" \
+"                   __local float *lcurve)                            \\\n" \
+"{                                                                    \\\n" \
+"   for (int j = get_local_id(0); j < samples; j += get_local_size(0)) \\\n" \
+"      lcurve[j] = curve[j];                                          \\\n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                     \\\n" \
+"   for (size_t i = get_global_id(0); i < count; i += get_global_size(0)) { \\\n" \
+"      float2 in = input[i];                                          \\\n" \
+"      output[i] = (float2) (lookup(lcurve, in.x, samples), in.y);    \\\n" \
+"   }                                                                 \\\n" \
+"}                                                                    \n" \
+"STAGED(contrast_local, __local_nearest)                              \n" \
+"STAGED(contrast_local_linear, __local_linear)                        \n" \
+"\n";
+
+/* Histogram equalization: per work-group __local histograms merged into
+ * hist with atomics, then one work-group turns hist into the cumulative
+ * distribution used as contrast curve. Binning matches contrast. */
+const char equalizeSource[] = "             \n" \
+"__kernel void histogram(                \n" \
+"   __global const float2 *input,        \n" \
+"   __global uint *hist,                 \n" \
+"                  int samples,          \n" \
+"                  unsigned count,       \n" \
+"   __local uint *lhist)                 \n" \
+"{                                       \n" \
+"   for (int j = get_local_id(0); j < samples; j += get_local_size(0)) \n" \
+"      lhist[j] = 0;                     \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);        \n" \
+"   for (size_t i = get_global_id(0); i < count; i += get_global_size(0)) { \n" \
+"      int x = input[i].x * samples;     \n" \
+"      atomic_inc(&lhist[clamp(x, 0, samples - 1)]); \n" \
+"   }                                    \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);        \n" \
+"   for (int j = get_local_id(0); j < samples; j += get_local_size(0)) \n" \
+"      if (lhist[j])                     \n" \
+"         atomic_add(&hist[j], lhist[j]); \n" \
+"}                                       \n" \
+"                                        \n" \
+"__kernel void histogram_curve(          \n" \
+"   __global const uint *hist,           \n" \
+"   __global float *curve,               \n" \
+"                  int samples,          \n" \
+"                  unsigned count,       \n" \
+"   __local uint *partial)               \n" \
+"{                                       \n" \
+"   int lid = get_local_id(0);           \n" \
+"   int lsize = get_local_size(0);       \n" \
+"   int per = (samples + lsize - 1) / lsize; \n" \
+"   int begin = min(lid * per, samples); \n" \
+"   int end = min(begin + per, samples); \n" \
+"   uint sum = 0;                        \n" \
+"   for (int j = begin; j < end; ++j)    \n" \
+"      sum += hist[j];                   \n" \
+"   partial[lid] = sum;                  \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);        \n" \
+"   /* inclusive scan of the per work item sums */ \n" \
+"   for (int off = 1; off < lsize; off <<= 1) { \n" \
+"      uint v = lid >= off ? partial[lid - off] : 0; \n" \
+"      barrier(CLK_LOCAL_MEM_FENCE);     \n" \
+"      partial[lid] += v;                \n" \
+"      barrier(CLK_LOCAL_MEM_FENCE);     \n" \
+"   }                                    \n" \
+"   uint run = lid ? partial[lid - 1] : 0; \n" \
+"   for (int j = begin; j < end; ++j) {  \n" \
+"      run += hist[j];                   \n" \
+"      curve[j] = (float)run / (float)count; \n" \
+"   }                                    \n" \
+"}                                       \n" \
 "\n";
 
 enum {
 	DATA_SIZE = 64,
 	CURVE_POINTS = 5,
+	/* 2D tiled mode */
+	PITCH_PAD = 64,
+	TILE_RUNS = 10,
+	TILE_CURVE_POINTS = 256,
+	/* histogram equalization mode */
+	EQ_LOCAL_SIZE = 256,
+	EQ_GROUPS_PER_CU = 8,
+	/* the device divides with up to 2.5 ulp error */
+	EQ_CURVE_ULPS = 3,
+	/* LUT placement mode */
+	LUT_RUNS = 5,
+	LUT_LOCAL_SIZE = 256,
+	LUT_GROUPS_PER_CU = 8,
+	/* same lerp as lut_reference, the device may contract it to fma */
+	LUT_ULPS = 1,
+	/* buffer vs image mode */
+	IMAGE_CURVE_POINTS = 256,
+	IMAGE_RUNS = 10,
+	MAX_REPORTED = 16,
+};
+
+/* Texture units snap coordinates to a fixed point grid, so a value that
+ * lands within 1/256 of a curve point boundary may pick either side. */
+static bool nearest_ok(const float *curve, int samples, float x, float result)
+{
+	const float pos = x * samples;
+	const int idx = std::min(std::max((int)pos, 0), samples - 1);
+	if (result == curve[idx])
+		return true;
+	const float frac = pos - std::floor(pos);
+	if (frac < 1.0f / 256 && idx > 0 && result == curve[idx - 1])
+		return true;
+	if (frac > 1.0f - 1.0f / 256 && idx < samples - 1 &&
+	    result == curve[idx + 1])
+		return true;
+	return false;
+}
+
+/* Linear filtering weights are low precision on most hardware, allow
+ * 1/256 of the largest step between neighbouring curve points. */
+static bool linear_ok(const float *curve, int samples, float max_step,
+                      float x, float result)
+{
+	const float t = std::min(std::max(x, 0.0f), 1.0f) * (samples - 1);
+	const int idx = std::min((int)t, samples - 2);
+	const float frac = t - idx;
+	const float expected = curve[idx] + frac * (curve[idx + 1] - curve[idx]);
+	return std::fabs(result - expected) <= max_step / 256 + 1e-6f;
+}
+
+/* Runs the buffer contrast kernel and both image variants side by side
+ * at several frame sizes. */
+static int run_image(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const cl::Program &prg)
+{
+	if (!devices[0].getInfo<CL_DEVICE_IMAGE_SUPPORT>()) {
+		std::cout << "Device has no image support" << std::endl;
+		return 0;
+	}
+	cl::Program::Sources src(1, std::make_pair(imageSource, std::strlen(imageSource)));
+	cl::Program img_prg(ctx, src);
+	try {
+		int ret = bench::build(img_prg, ctx, devices, bench::build_options());
+		if (ret != CL_SUCCESS) {
+			std::cout <<"BUILD FAIL" << std::endl;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Build failed:\n" << e.what() << " "
+			<< e.err() << std::endl;
+		std::cerr << "BUILD LOG:\n" <<
+			img_prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+			<< "\nLOG DONE\n";
+		return 1;
+	}
+
+	/* gamma like curve so that interpolation matters */
+	const int samples = IMAGE_CURVE_POINTS;
+	std::vector<float> curve(samples), curve_rgba(samples * 4);
+	float max_step = 0;
+	for (int i = 0; i < samples; ++i) {
+		curve[i] = std::pow(i / (float)(samples - 1), 1.0f / 2.2f);
+		for (unsigned c = 0; c < 4; ++c)
+			curve_rgba[i * 4 + c] = curve[i];
+		if (i)
+			max_step = std::max(max_step, curve[i] - curve[i - 1]);
+	}
+
+	static const unsigned sizes[][2] = {
+		{ 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 },
+	};
+	const cl::ImageFormat format(CL_RGBA, CL_FLOAT);
+	unsigned errors = 0;
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		/* two pixels per RGBA texel */
+		const unsigned width = sizes[s][0] / 2, height = sizes[s][1];
+		const size_t pixels = (size_t)sizes[s][0] * height;
+		const size_t bytes = pixels * 2 * sizeof(float);
+		std::vector<float> data(pixels * 2), nearest(pixels * 2);
+		std::vector<float> linear(pixels * 2), buffered(pixels * 2);
+		for (size_t i = 0; i < pixels * 2; ++i)
+			data[i] = (float)rand() / (float)RAND_MAX;
+
+		double buffer_time, nearest_time, linear_time;
+		try {
+			cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+			cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data[0]);
+			cl::Buffer cur = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				samples * sizeof(float), &curve[0]);
+			cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+			cl::Kernel kernel(prg, "contrast");
+			kernel.setArg(0, in);
+			kernel.setArg(1, out);
+			kernel.setArg(2, cur);
+			kernel.setArg(3, samples);
+			buffer_time = bench::best_time(cmd, kernel, cl::NDRange(pixels),
+			                               cl::NullRange, IMAGE_RUNS);
+			cmd.enqueueReadBuffer(out, true, 0, bytes, &buffered[0]);
+
+			cl::Image2D img_in = bench::image2d(ctx,
+				CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				format, width, height, &data[0]);
+			cl::Image2D img_out = bench::image2d(ctx, CL_MEM_WRITE_ONLY,
+				format, width, height);
+			cl::Image1D img_curve = bench::image1d(ctx,
+				CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				format, samples, &curve_rgba[0]);
+			cl::size_t<3> origin, region;
+			origin[0] = origin[1] = origin[2] = 0;
+			region[0] = width;
+			region[1] = height;
+			region[2] = 1;
+
+			cl::Kernel img_kernel(img_prg, "contrast_image");
+			img_kernel.setArg(0, img_in);
+			img_kernel.setArg(1, img_out);
+			img_kernel.setArg(2, img_curve);
+			img_kernel.setArg(3, samples);
+			nearest_time = bench::best_time(cmd, img_kernel,
+				cl::NDRange(width, height), cl::NullRange, IMAGE_RUNS);
+			cmd.enqueueReadImage(img_out, true, origin, region, 0, 0,
+				&nearest[0]);
+
+			cl::Kernel lin_kernel(img_prg, "contrast_image_linear");
+			lin_kernel.setArg(0, img_in);
+			lin_kernel.setArg(1, img_out);
+			lin_kernel.setArg(2, img_curve);
+			lin_kernel.setArg(3, samples);
+			linear_time = bench::best_time(cmd, lin_kernel,
+				cl::NDRange(width, height), cl::NullRange, IMAGE_RUNS);
+			cmd.enqueueReadImage(img_out, true, origin, region, 0, 0,
+				&linear[0]);
+		} catch (cl::Error e) {
+			std::cerr << sizes[s][0] << "x" << height << " failed: "
+				<< e.what() << " " << e.err() << std::endl;
+			return 1;
+		}
+		const std::string size = std::to_string(sizes[s][0]) + "x" +
+			std::to_string(height);
+		bench::report(size + " buffer", pixels, buffer_time, 2 * bytes);
+		bench::report(size + " image nearest", pixels, nearest_time, 2 * bytes);
+		bench::report(size + " image linear", pixels, linear_time, 2 * bytes);
+
+		unsigned size_errors = 0, reported = 0;
+		bench::parallel_for(pixels, [&](size_t begin, size_t end) {
+			unsigned local_errors = 0;
+			for (size_t i = begin; i < end; ++i) {
+				const float x = data[i * 2], y = data[i * 2 + 1];
+				const bool ok =
+					nearest_ok(&curve[0], samples, x, buffered[i * 2]) &&
+					nearest_ok(&curve[0], samples, x, nearest[i * 2]) &&
+					linear_ok(&curve[0], samples, max_step, x, linear[i * 2]) &&
+					buffered[i * 2 + 1] == y &&
+					nearest[i * 2 + 1] == y && linear[i * 2 + 1] == y;
+				if (ok)
+					continue;
+				++local_errors;
+				std::lock_guard<std::mutex> guard(bench::log_lock());
+				if (reported++ >= MAX_REPORTED)
+					continue;
+				std::cerr << "Incorrect element(" << i << "): "
+					<< x << " buffer: " << buffered[i * 2]
+					<< " nearest: " << nearest[i * 2]
+					<< " linear: " << linear[i * 2] << std::endl;
+			}
+			std::lock_guard<std::mutex> guard(bench::log_lock());
+			size_errors += local_errors;
+		});
+		errors += size_errors;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+enum lut_space { LUT_CONSTANT, LUT_GLOBAL, LUT_LOCAL, LUT_SPACES };
+static const char *lut_space_names[LUT_SPACES] = { "constant", "global", "local" };
+
+/* Host version of the nearest/linear lookups in lutSource */
+static float lut_reference(const float *curve, int samples, float v,
+                           bool linear)
+{
+	if (!linear) {
+		const int x = (int)(v * samples);
+		return curve[std::min(std::max(x, 0), samples - 1)];
+	}
+	const float t = std::min(std::max(v, 0.0f), 1.0f) * (samples - 1);
+	const int x = std::min((int)t, samples - 2);
+	return curve[x] + (curve[x + 1] - curve[x]) * (t - x);
+}
+
+/* Sweeps curve size x image size for every LUT placement, with and
+ * without interpolation. Placements whose curve does not fit the
+ * device's constant buffer or local memory are skipped. */
+static int run_lut(const cl::Context &ctx,
+                   const cl::vector<cl::Device> &devices)
+{
+	cl::Program::Sources src(1, std::make_pair(lutSource, std::strlen(lutSource)));
+	cl::Program lut_prg(ctx, src);
+	try {
+		int ret = bench::build(lut_prg, ctx, devices, bench::build_options());
+		if (ret != CL_SUCCESS) {
+			std::cout <<"BUILD FAIL" << std::endl;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Build failed:\n" << e.what() << " "
+			<< e.err() << std::endl;
+		std::cerr << "BUILD LOG:\n" <<
+			lut_prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+			<< "\nLOG DONE\n";
+		return 1;
+	}
+
+	const cl_ulong max_constant =
+		devices[0].getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+	const cl_ulong max_local = devices[0].getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	const size_t groups = devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() *
+		LUT_GROUPS_PER_CU;
+
+	static const int curve_sizes[] = { 256, 1024, 4096, 16384, 65536 };
+	static const size_t image_sizes[] = {
+		1 << 20, 4 << 20, 16 << 20, 32 << 20,
+	};
+	/* in and out hold two floats per pixel, data and results as well */
+	const size_t max_pixels = bench::fit_elements(devices[0],
+		image_sizes[3], 4 * sizeof(float), 2 * sizeof(float),
+		4 * sizeof(float), image_sizes[0]);
+	if (max_pixels < image_sizes[3])
+		std::cout << "Device memory fits " << (max_pixels >> 20)
+			<< "M pixels" << std::endl;
+
+	std::vector<float> data(max_pixels * 2), results(max_pixels * 2);
+	uint64_t seed = 0x6a09e667f3bcc909ULL;
+	for (size_t i = 0; i < max_pixels * 2; ++i)
+		data[i] = bench::randf(seed);
+
+	unsigned errors = 0;
+	try {
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			max_pixels * 2 * sizeof(float), &data[0]);
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, max_pixels * 2 * sizeof(float));
+
+		for (int samples : curve_sizes) {
+			const size_t curve_bytes = samples * sizeof(float);
+			std::vector<float> curve(samples);
+			for (int i = 0; i < samples; ++i)
+				curve[i] = std::pow(i / (float)(samples - 1), 1.0f / 2.2f);
+			cl::Buffer cur = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				curve_bytes, &curve[0]);
+
+			for (size_t pixels : image_sizes)
+			for (unsigned space = 0; space < LUT_SPACES; ++space)
+			for (unsigned linear = 0; linear < 2; ++linear) {
+				const std::string what = "curve " +
+					std::to_string(samples) + " pixels " +
+					std::to_string(pixels >> 20) + "M " +
+					lut_space_names[space] +
+					(linear ? " linear" : " nearest");
+				if ((space == LUT_CONSTANT && curve_bytes > max_constant) ||
+				    (space == LUT_LOCAL && curve_bytes > max_local)) {
+					std::cout << what << ": skipped, curve does not fit"
+						<< std::endl;
+					continue;
+				}
+				if (pixels > max_pixels) {
+					std::cout << what << ": skipped, not enough memory"
+						<< std::endl;
+					continue;
+				}
+				const std::string name = std::string("contrast_") +
+					lut_space_names[space] + (linear ? "_linear" : "");
+				cl::Kernel kernel(lut_prg, name.c_str());
+				kernel.setArg(0, in);
+				kernel.setArg(1, out);
+				kernel.setArg(2, cur);
+				kernel.setArg(3, samples);
+				kernel.setArg(4, (unsigned)pixels);
+				if (space == LUT_LOCAL)
+					kernel.setArg(5, cl::Local(curve_bytes));
+
+				const size_t local = std::min<size_t>(LUT_LOCAL_SIZE,
+					kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]));
+				const size_t global = std::min(groups * local, pixels);
+				const double best = bench::best_time(cmd, kernel,
+					cl::NDRange(global), cl::NDRange(local), LUT_RUNS);
+				cmd.enqueueReadBuffer(out, true, 0,
+					pixels * 2 * sizeof(float), &results[0]);
+				bench::report(what, pixels, best,
+					pixels * 4 * sizeof(float));
+
+				unsigned wrong = 0;
+				bench::parallel_for(pixels, [&](size_t begin, size_t end) {
+					unsigned local_errors = 0;
+					for (size_t i = begin; i < end; ++i) {
+						const float x = data[i * 2];
+						const float expected = lut_reference(
+							&curve[0], samples, x, linear);
+						if (bench::ulp_error(results[i * 2], expected) > LUT_ULPS ||
+						    results[i * 2 + 1] != data[i * 2 + 1])
+							++local_errors;
+					}
+					std::lock_guard<std::mutex> guard(bench::log_lock());
+					wrong += local_errors;
+				});
+				if (wrong)
+					std::cout << "Wrong " << what << ": " << wrong
+						<< "/" << pixels << std::endl;
+				errors += wrong;
+			}
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+/* Three stage histogram equalization on the device: histogram, curve
+ * and the existing contrast kernel, chained with events only. The
+ * intermediate buffers are read back afterwards for verification. */
+static int run_equalize(const cl::Context &ctx,
+                        const cl::vector<cl::Device> &devices,
+                        const cl::Program &prg)
+{
+	cl::Program::Sources src(1, std::make_pair(equalizeSource, std::strlen(equalizeSource)));
+	cl::Program eq_prg(ctx, src);
+	try {
+		int ret = bench::build(eq_prg, ctx, devices, bench::build_options());
+		if (ret != CL_SUCCESS) {
+			std::cout <<"BUILD FAIL" << std::endl;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Build failed:\n" << e.what() << " "
+			<< e.err() << std::endl;
+		std::cerr << "BUILD LOG:\n" <<
+			eq_prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+			<< "\nLOG DONE\n";
+		return 1;
+	}
+
+	static const int bin_counts[] = { 256, 4096 };
+	static const size_t image_sizes[] = { 8 << 20, 32 << 20 };
+	const size_t max_pixels = bench::fit_elements(devices[0],
+		image_sizes[1], 4 * sizeof(float), 2 * sizeof(float),
+		4 * sizeof(float), image_sizes[0]);
+	const size_t groups = devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() *
+		EQ_GROUPS_PER_CU;
+
+	/* skewed towards dark values so the equalized curve is not linear */
+	std::vector<float> data(max_pixels * 2), results(max_pixels * 2);
+	uint64_t seed = 0xbb67ae8584caa73bULL;
+	for (size_t i = 0; i < max_pixels * 2; ++i) {
+		const float v = bench::randf(seed);
+		data[i] = i & 1 ? v : v * v;
+	}
+
+	unsigned errors = 0;
+	try {
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			max_pixels * 2 * sizeof(float), &data[0]);
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, max_pixels * 2 * sizeof(float));
+
+		for (int samples : bin_counts)
+		for (size_t pixels : image_sizes) {
+			if (pixels > max_pixels) {
+				std::cout << samples << " bins " << (pixels >> 20)
+					<< "M pixels: skipped, not enough memory"
+					<< std::endl;
+				continue;
+			}
+			cl::Buffer hist = bench::buffer(ctx, CL_MEM_READ_WRITE, samples * sizeof(cl_uint));
+			cl::Buffer cur = bench::buffer(ctx, CL_MEM_READ_WRITE, samples * sizeof(float));
+
+			cl::Kernel histogram(eq_prg, "histogram");
+			histogram.setArg(0, in);
+			histogram.setArg(1, hist);
+			histogram.setArg(2, samples);
+			histogram.setArg(3, (unsigned)pixels);
+			histogram.setArg(4, cl::Local(samples * sizeof(cl_uint)));
+			const size_t hist_local = std::min<size_t>(EQ_LOCAL_SIZE,
+				histogram.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]));
+
+			cl::Kernel curve(eq_prg, "histogram_curve");
+			curve.setArg(0, hist);
+			curve.setArg(1, cur);
+			curve.setArg(2, samples);
+			curve.setArg(3, (unsigned)pixels);
+			const size_t curve_local = std::min<size_t>(EQ_LOCAL_SIZE,
+				curve.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]));
+			curve.setArg(4, cl::Local(curve_local * sizeof(cl_uint)));
+
+			cl::Kernel kernel(prg, "contrast");
+			kernel.setArg(0, in);
+			kernel.setArg(1, out);
+			kernel.setArg(2, cur);
+			kernel.setArg(3, samples);
+
+			cl::Event clear_ev, hist_ev, curve_ev, apply_ev;
+			const cl_uint zero = 0;
+			cmd.enqueueFillBuffer(hist, zero, 0,
+				samples * sizeof(cl_uint), NULL, &clear_ev);
+			cl::vector<cl::Event> deps(1, clear_ev);
+			cmd.enqueueNDRangeKernel(histogram, cl::NullRange,
+				cl::NDRange(groups * hist_local),
+				cl::NDRange(hist_local), &deps, &hist_ev);
+			deps[0] = hist_ev;
+			cmd.enqueueNDRangeKernel(curve, cl::NullRange,
+				cl::NDRange(curve_local), cl::NDRange(curve_local),
+				&deps, &curve_ev);
+			deps[0] = curve_ev;
+			cmd.enqueueNDRangeKernel(kernel, cl::NullRange,
+				cl::NDRange(pixels), cl::NullRange, &deps, &apply_ev);
+			apply_ev.wait();
+
+			const std::string what = std::to_string(samples) +
+				" bins " + std::to_string(pixels >> 20) + "M pixels ";
+			const size_t bytes = pixels * 2 * sizeof(float);
+			bench::report(what + "histogram", pixels,
+				bench::event_seconds(hist_ev), bytes);
+			bench::report(what + "curve", samples,
+				bench::event_seconds(curve_ev));
+			bench::report(what + "contrast", pixels,
+				bench::event_seconds(apply_ev), 2 * bytes);
+			const double total =
+				(apply_ev.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+				 clear_ev.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1e-9;
+			bench::report(what + "end to end", pixels, total, 3 * bytes);
+
+			/* verification only, not part of the pipeline */
+			std::vector<cl_uint> dev_hist(samples);
+			std::vector<float> dev_curve(samples);
+			cmd.enqueueReadBuffer(hist, true, 0,
+				samples * sizeof(cl_uint), &dev_hist[0]);
+			cmd.enqueueReadBuffer(cur, true, 0,
+				samples * sizeof(float), &dev_curve[0]);
+			cmd.enqueueReadBuffer(out, true, 0, bytes, &results[0]);
+
+			std::vector<cl_uint> host_hist(samples, 0);
+			for (size_t i = 0; i < pixels; ++i) {
+				const int x = (int)(data[i * 2] * samples);
+				++host_hist[std::min(std::max(x, 0), samples - 1)];
+			}
+			unsigned wrong = 0;
+			cl_uint run = 0;
+			for (int j = 0; j < samples; ++j) {
+				run += host_hist[j];
+				const float expected = (float)run / (float)pixels;
+				if (dev_hist[j] != host_hist[j] ||
+				    bench::ulp_error(dev_curve[j], expected) > EQ_CURVE_ULPS) {
+					++wrong;
+					std::cerr << "Incorrect bin(" << j << "): "
+						<< dev_hist[j] << " correct: "
+						<< host_hist[j] << " curve: "
+						<< dev_curve[j] << " correct: "
+						<< expected << std::endl;
+				}
+			}
+			bench::parallel_for(pixels, [&](size_t begin, size_t end) {
+				unsigned local_errors = 0;
+				for (size_t i = begin; i < end; ++i) {
+					const int x = (int)(data[i * 2] * samples);
+					const float expected = dev_curve[
+						std::min(std::max(x, 0), samples - 1)];
+					if (results[i * 2] != expected ||
+					    results[i * 2 + 1] != data[i * 2 + 1])
+						++local_errors;
+				}
+				std::lock_guard<std::mutex> guard(bench::log_lock());
+				wrong += local_errors;
+			});
+			if (wrong)
+				std::cout << "Wrong " << what << ": " << wrong
+					<< std::endl;
+			errors += wrong;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+/* Work-group shapes for contrast_2d, 256x1 is plain row-major */
+static const unsigned tile_shapes[][2] = {
+	{ 256, 1 }, { 128, 2 }, { 64, 4 }, { 32, 8 }, { 16, 16 }, { 8, 32 },
 };
 
+/* Runs contrast_2d on pitched 4K and 8K images for every tile shape
+ * next to the 1D contrast kernel over the same padded image. Output
+ * padding is filled with a sentinel that has to survive. */
+static int run_tiled(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const cl::Program &prg)
+{
+	static const unsigned sizes[][2] = { { 3840, 2160 }, { 7680, 4320 } };
+	const int samples = TILE_CURVE_POINTS;
+	std::vector<float> curve(samples);
+	for (int i = 0; i < samples; ++i)
+		curve[i] = (float)i * (1.0f / ((float)(samples - 1)));
+
+	unsigned errors = 0;
+	uint64_t seed = 0x9b05688c2b3e6c1fULL;
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		const unsigned width = sizes[s][0], height = sizes[s][1];
+		const unsigned pitch = width + PITCH_PAD;
+		const size_t padded = (size_t)pitch * height;
+		const size_t bytes = padded * 2 * sizeof(float);
+		const size_t pixels = (size_t)width * height;
+		const size_t moved = pixels * 4 * sizeof(float);
+		std::cout << "Tiled " << width << "x" << height << " pitch "
+			<< pitch << std::endl;
+
+		std::vector<float> data(padded * 2), results(padded * 2);
+		for (size_t i = 0; i < padded * 2; ++i)
+			data[i] = bench::randf(seed);
+		const std::vector<float> sentinel(padded * 2, -1.0f);
+
+		try {
+			cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+			cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data[0]);
+			cl::Buffer cur = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				samples * sizeof(float), &curve[0]);
+			cl::Buffer out = bench::buffer(ctx, CL_MEM_READ_WRITE, bytes);
+
+			cl::Kernel flat(prg, "contrast");
+			flat.setArg(0, in);
+			flat.setArg(1, out);
+			flat.setArg(2, cur);
+			flat.setArg(3, samples);
+			bench::report("1D flat (incl. padding)", pixels,
+				bench::best_time(cmd, flat, cl::NDRange(padded),
+				                 cl::NullRange, TILE_RUNS),
+				moved);
+
+			cl::Kernel kernel(prg, "contrast_2d");
+			kernel.setArg(0, in);
+			kernel.setArg(1, out);
+			kernel.setArg(2, cur);
+			kernel.setArg(3, samples);
+			kernel.setArg(4, (int)width);
+			kernel.setArg(5, (int)height);
+			kernel.setArg(6, (int)pitch);
+			const size_t max_group =
+				kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]);
+			for (unsigned t = 0; t < sizeof(tile_shapes) / sizeof(tile_shapes[0]); ++t) {
+				const unsigned tx = tile_shapes[t][0], ty = tile_shapes[t][1];
+				const std::string what = "2D " + std::to_string(tx) +
+					"x" + std::to_string(ty);
+				if (tx * ty > max_group) {
+					std::cout << what << ": skipped, work-group too large"
+						<< std::endl;
+					continue;
+				}
+				cmd.enqueueWriteBuffer(out, true, 0, bytes, &sentinel[0]);
+				const double best = bench::best_time(cmd, kernel,
+					cl::NDRange(bench::round_up(width, tx),
+					            bench::round_up(height, ty)),
+					cl::NDRange(tx, ty), TILE_RUNS);
+				cmd.enqueueReadBuffer(out, true, 0, bytes, &results[0]);
+				bench::report(what, pixels, best, moved);
+
+				unsigned wrong = 0;
+				bench::parallel_for(height, [&](size_t begin, size_t end) {
+					unsigned local_errors = 0;
+					for (size_t y = begin; y < end; ++y)
+					for (size_t x = 0; x < pitch; ++x) {
+						const size_t i = (y * pitch + x) * 2;
+						if (x >= width) {
+							local_errors += results[i] != -1.0f ||
+								results[i + 1] != -1.0f;
+							continue;
+						}
+						const int idx = (int)(data[i] * samples);
+						const float expected = curve[
+							std::min(std::max(idx, 0), samples - 1)];
+						local_errors += results[i] != expected ||
+							results[i + 1] != data[i + 1];
+					}
+					std::lock_guard<std::mutex> guard(bench::log_lock());
+					wrong += local_errors;
+				});
+				if (wrong)
+					std::cout << "Wrong " << what << ": " << wrong
+						<< std::endl;
+				errors += wrong;
+			}
+		} catch (cl::Error e) {
+			std::cerr << "Tiled failed: " << e.what() << " "
+				<< e.err() << std::endl;
+			return 1;
+		}
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
 int main(int argc, const char*argv[])
 {
+	bench::memory_reporter memory;
+	/* --image compares buffer and image contrast at several sizes,
+	 * --lut sweeps curve placement x curve size x image size,
+	 * --equalize runs the histogram equalization pipeline,
+	 * --tiled compares 2D work-group shapes on pitched images,
+	 * default is the small host_ptr check. */
+	bool image = false, lut = false, equalize = false, tiled = false;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--image")
+			image = true;
+		else if (arg == "--lut")
+			lut = true;
+		else if (arg == "--equalize")
+			equalize = true;
+		else if (arg == "--tiled")
+			tiled = true;
+		else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+
 	float data[DATA_SIZE]; // original data set given to device
 	float results[DATA_SIZE];    // results returned from device
 	float curve[CURVE_POINTS];
 
+	bench::perf::scope perf_input("input", DATA_SIZE);
         for (unsigned i = 0; i < DATA_SIZE; i++)
 	        data[i] = (float)rand() /(float)RAND_MAX;
+	perf_input.end();
 	for (unsigned i = 0; i < CURVE_POINTS; ++i)
 		curve[i] = (float)i * (1.0f / ((float)(CURVE_POINTS - 1)));
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -74,19 +907,21 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer in(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
-	cl::Buffer cur(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(curve), curve);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
+	cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
+	cl::Buffer cur = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(curve), curve);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -107,6 +942,15 @@ int main(int argc, const char*argv[])
 			prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
 			<< "\nLOG DONE\n";
 
+	bench::trace::phase("run");
+	if (image)
+		return run_image(ctx, devices, prg);
+	if (lut)
+		return run_lut(ctx, devices);
+	if (equalize)
+		return run_equalize(ctx, devices, prg);
+	if (tiled)
+		return run_tiled(ctx, devices, prg);
 
 	/* Create kernel and set arguments */
 	try {
@@ -137,6 +981,7 @@ int main(int argc, const char*argv[])
 		return 1;
 	}
 	unsigned errors = 0;
+	bench::perf::scope perf_verify("verify", DATA_SIZE);
 	for (int i = 0; i < DATA_SIZE; ++i) {
 		float result = i & 1 ? data[i] : curve[(int)(data[i] * CURVE_POINTS)];
 		if (result != results[i]) {
@@ -146,6 +991,7 @@ int main(int argc, const char*argv[])
 				<< " correct: " << result << std::endl;
 		}
 	}
+	perf_verify.end();
 
 	std::cout << "Wrong: " << errors << "/" << DATA_SIZE << std::endl;
 
@@ -1,11 +1,15 @@
 #include <cmath>
 #include <iostream>
+#include <string>
 #include <vector>
 
 
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+
 #define VECTOR
 
 // Simple compute kernel which computes the square of an input array
@@ -31,61 +35,27 @@ enum {
 	DATA_SIZE = 64,
 };
 
-int main(int argc, const char*argv[])
+/* Builds the kernels with options, runs them over data and counts the
+ * wrong scalar and vector results in errors, the device time of each
+ * launch goes to seconds. Returns 1 if the build or a launch failed. */
+static int run_check(const cl::Context &ctx,
+                     const std::vector<cl::Device> &devices,
+                     float *data, const std::string &options,
+                     unsigned errors[2], double seconds[2])
 {
-	(void) argc;
-	(void) argv;
-
-	float data[DATA_SIZE];       // original data set given to device
 	int results[DATA_SIZE];    // results returned from device
 	int results2[DATA_SIZE];   // results returned from device
 
-        for(unsigned i = 3; i < DATA_SIZE; i++)
-		data[i] = rand() / (float)RAND_MAX;
-	data[0] = 0.0f;
-	data[1] = NAN;
-	data[2] = INFINITY;
-
-	std::vector< cl::Platform > platformList;
-	cl::Platform::get(&platformList);
-	std::cout << "Platform count is: " << platformList.size() << std::endl;
-	if (platformList.size() < 1)
-		return 1;
-
-	cl::Platform platform = platformList[0];
-
-	std::string vendor, name, version;
-	platform.getInfo(CL_PLATFORM_VENDOR, &vendor);
-	platform.getInfo(CL_PLATFORM_NAME, &name);
-	platform.getInfo(CL_PLATFORM_VERSION, &version);
-	std::cout << "Platform is `" << name << "' by: " << vendor
-		<< " version: " << version << std::endl;
-
-	std::vector <cl::Device> devices;
-	platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-	std::cout << devices.size() << " available device(s)\n";
-	if (devices.size() == 0)
-		return 1;
-
-	devices[0].getInfo(CL_DEVICE_VENDOR, &vendor);
-	devices[0].getInfo(CL_DEVICE_NAME, &name);
-	devices[0].getInfo(CL_DEVICE_VERSION, &version);
-	std::cout << "Platform is `" << name << "' by: " << vendor
-	          << " version: " << version << std::endl;
-
-	/* Create CL context */
-	cl::Context ctx(devices);
-
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer in(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
-	cl::Buffer out2(ctx, CL_MEM_WRITE_ONLY, sizeof(results2));
+	cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, DATA_SIZE * sizeof(float), data);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
+	cl::Buffer out2 = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results2));
 
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options(options));
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -100,7 +70,6 @@ int main(int argc, const char*argv[])
 		return 1;
 	}
 
-
 	/* Create kernel and set arguments */
 	try {
 		cl::Kernel kernel(prg, "pow_test");
@@ -113,10 +82,13 @@ int main(int argc, const char*argv[])
 		std::cout << "Local size is: " << local[2] << std::endl;
 
 		/* Command queue */
-		cl::CommandQueue cmd(ctx, devices[0]);
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
 
-		cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0), cl::NDRange(DATA_SIZE), cl::NDRange(1));
+		seconds[0] = seconds[1] = 0;
+		cl::Event ev;
+		cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0), cl::NDRange(DATA_SIZE), cl::NDRange(1), NULL, &ev);
 		cmd.finish();
+		seconds[0] = bench::event_seconds(ev);
 		cmd.enqueueReadBuffer(out, true, 0, sizeof(results), results, 0);
 #ifdef VECTOR
 		/* test vector pow */
@@ -125,8 +97,9 @@ int main(int argc, const char*argv[])
 		kernel2.setArg(1, out2);
 
 		/* Command queue */
-		cmd.enqueueNDRangeKernel(kernel2, cl::NDRange(0), cl::NDRange(DATA_SIZE / 4), cl::NDRange(1));
+		cmd.enqueueNDRangeKernel(kernel2, cl::NDRange(0), cl::NDRange(DATA_SIZE / 4), cl::NDRange(1), NULL, &ev);
 		cmd.finish();
+		seconds[1] = bench::event_seconds(ev);
 		cmd.enqueueReadBuffer(out2, true, 0, sizeof(results2), results2, 0);
 #endif
 	} catch (cl::Error e) {
@@ -136,28 +109,121 @@ int main(int argc, const char*argv[])
 	} catch (...) {
 		return 1;
 	}
-	unsigned errors1 = 0, errors2 = 0;
+	errors[0] = errors[1] = 0;
+	bench::perf::scope perf_verify("verify", DATA_SIZE);
 	for (int i = 0; i < DATA_SIZE; ++i) {
 		int result = ::std::ilogb(data[i]);
 		if (result - results[i]) {
-			++errors1;
+			++errors[0];
 			std::cerr << "Incorrect element(" << i << "): "
 				<< data[i] << " result: " << results[i]
 				<< " correct: " << result << std::endl;
 		}
 #ifdef VECTOR
 		if (result - results2[i]) {
-			++errors2;
+			++errors[1];
 			std::cerr << "Incorrect element2(" << i << "): "
 				<< data[i] << " result: " << results2[i]
 				<< " correct: " << result << std::endl;
 		}
 #endif
 	}
+	perf_verify.end();
 
-	std::cout << "Wrong1: " << errors1 << "/" << DATA_SIZE << std::endl;
+	return 0;
+}
+
+int main(int argc, const char*argv[])
+{
+	bench::memory_reporter memory;
+	/* --matrix runs the check once per compile option set */
+	bool matrix = false;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--matrix") {
+			matrix = true;
+		} else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	float data[DATA_SIZE];       // original data set given to device
+
+	bench::perf::scope perf_input("input", DATA_SIZE);
+        for(unsigned i = 3; i < DATA_SIZE; i++)
+		data[i] = rand() / (float)RAND_MAX;
+	perf_input.end();
+	data[0] = 0.0f;
+	data[1] = NAN;
+	data[2] = INFINITY;
+
+	bench::trace::phase("platform");
+	std::vector< cl::Platform > platformList;
+	cl::Platform::get(&platformList);
+	std::cout << "Platform count is: " << platformList.size() << std::endl;
+	if (platformList.size() < 1)
+		return 1;
+
+	cl::Platform platform = platformList[0];
+
+	std::string vendor, name, version;
+	platform.getInfo(CL_PLATFORM_VENDOR, &vendor);
+	platform.getInfo(CL_PLATFORM_NAME, &name);
+	platform.getInfo(CL_PLATFORM_VERSION, &version);
+	std::cout << "Platform is `" << name << "' by: " << vendor
+		<< " version: " << version << std::endl;
+
+	std::vector <cl::Device> devices;
+	platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+	std::cout << devices.size() << " available device(s)\n";
+	if (devices.size() == 0)
+		return 1;
+
+	devices[0].getInfo(CL_DEVICE_VENDOR, &vendor);
+	devices[0].getInfo(CL_DEVICE_NAME, &name);
+	devices[0].getInfo(CL_DEVICE_VERSION, &version);
+	std::cout << "Platform is `" << name << "' by: " << vendor
+	          << " version: " << version << std::endl;
+
+	bench::trace::phase("context");
+	/* Create CL context */
+	cl::Context ctx(devices);
+
+	bench::trace::phase("run");
+	if (matrix) {
+		/* NaN, infinity and zero are the interesting inputs here */
+		std::vector<std::string> summary;
+		for (unsigned o = 0; o < bench::OPTION_SETS; ++o) {
+			std::cout << "Options: " << bench::option_sets[o].name
+				<< std::endl;
+			unsigned errors[2];
+			double seconds[2];
+			const int r = run_check(ctx, devices, data,
+				bench::option_sets[o].options, errors, seconds);
+			if (r && o == 0)
+				return r;
+			summary.push_back(std::string(bench::option_sets[o].name) +
+				(r ? ", failed" : ", " + std::to_string(errors[0]) +
+				 ", " + std::to_string(errors[1]) + ", " +
+				 std::to_string(seconds[0] ? DATA_SIZE / seconds[0] / 1e6 : 0) +
+				 ", " +
+				 std::to_string(seconds[1] ? DATA_SIZE / seconds[1] / 1e6 : 0)));
+		}
+		std::cout << "options, wrong scalar, wrong vector of "
+			<< DATA_SIZE << ", M/s scalar, M/s vector" << std::endl;
+		for (const std::string &row:summary)
+			std::cout << row << std::endl;
+		return 0;
+	}
+
+	unsigned errors[2];
+	double seconds[2];
+	if (run_check(ctx, devices, data, "", errors, seconds))
+		return 1;
+	std::cout << "Wrong1: " << errors[0] << "/" << DATA_SIZE << std::endl;
 #ifdef VECTOR
-	std::cout << "Wrong2: " << errors2 << "/" << DATA_SIZE << std::endl;
+	std::cout << "Wrong2: " << errors[1] << "/" << DATA_SIZE << std::endl;
 #endif
 	return 0;
 }
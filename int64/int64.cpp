@@ -1,45 +1,188 @@
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+
 #define LONG
 #define SW
 
+/* Built once per type, -DTYPE=uint and -DTYPE=ulong */
 const char kernelSource[] = "             \n" \
-"__kernel void test1(                   \n" \
-"   unsigned x,                             \n" \
-"   unsigned y,                             \n" \
-"   __global unsigned *output)              \n" \
+"typedef TYPE type;                      \n" \
+"__kernel void mul_test(                 \n" \
+"   __global const type *x,              \n" \
+"   __global const type *y,              \n" \
+"   __global type *output,               \n" \
+"   unsigned count)                      \n" \
+"{                                       \n" \
+"   int i = get_global_id(0);            \n" \
+"   if (i < count)                       \n" \
+"      output[i] = x[i] * y[i];          \n" \
+"}                                       \n" \
+"__kernel void div_test(                 \n" \
+"   __global const type *x,              \n" \
+"   __global const type *y,              \n" \
+"   __global type *output,               \n" \
+"   unsigned count)                      \n" \
 "{                                       \n" \
-"   output[0] = x * y;                   \n" \
-"   output[1] = x / y;                   \n" \
-"   output[2] = x % y;                   \n" \
+"   int i = get_global_id(0);            \n" \
+"   if (i < count)                       \n" \
+"      output[i] = x[i] / y[i];          \n" \
 "}                                       \n" \
-"                                        \n" \
-"__kernel void test2(                   \n" \
-"   ulong x,                             \n" \
-"   ulong y,                             \n" \
-"   __global ulong *output)              \n" \
+"__kernel void mod_test(                 \n" \
+"   __global const type *x,              \n" \
+"   __global const type *y,              \n" \
+"   __global type *output,               \n" \
+"   unsigned count)                      \n" \
 "{                                       \n" \
-"   output[0] = x * y;                   \n" \
-"   output[1] = x / y;                   \n" \
-"   output[2] = x % y;                   \n" \
+"   int i = get_global_id(0);            \n" \
+"   if (i < count)                       \n" \
+"      output[i] = x[i] % y[i];          \n" \
 "}                                       \n" \
 "\n";
 
 enum {
-	X = 6,
-	Y = 4,
+	DATA_SIZE = 4 * 1024 * 1024,
+	OPS = 3,
 };
 
+static const char *op_names[OPS] = { "MUL", "DIV", "MOD" };
+static const char *kernel_names[OPS] = { "mul_test", "div_test", "mod_test" };
+
+template<typename T>
+static T host_op(unsigned op, T x, T y)
+{
+	switch (op) {
+	case 0: return x * y;
+	case 1: return x / y;
+	default: return x % y;
+	}
+}
+
+/* Up to DATA_SIZE elements of T, two inputs and the output on both
+ * sides */
+template<typename T>
+static size_t element_count(const cl::Device &dev)
+{
+	const size_t count = bench::fit_elements(dev, DATA_SIZE,
+		3 * sizeof(T), sizeof(T), 3 * sizeof(T));
+	if (count < DATA_SIZE)
+		std::cout << "Device memory fits " << count << " elements of "
+			<< sizeof(T) * 8 << " bits" << std::endl;
+	return count;
+}
+
+/* Runs all three ops over count (x, y) pairs of type T, see
+ * element_count(). Returns the summed kernel time of the three ops, or a
+ * negative value on failure. */
+template<typename T>
+static double run_type(const cl::Context &ctx,
+                       const cl::vector<cl::Device> &devices,
+                       const cl::CommandQueue &cmd,
+                       const cl::Program::Sources &src,
+                       const std::string &type, size_t count)
+{
+	std::vector<T> x(count), y(count), results(count);
+
+	/* Spread the divisor magnitude so that quotients of all sizes show
+	 * up, the divisor is never 0. */
+	uint64_t seed = 0x9e3779b97f4a7c15ULL ^ sizeof(T);
+	for (size_t i = 0; i < count; ++i) {
+		x[i] = (T)bench::rand64(seed);
+		const uint64_t r = bench::rand64(seed);
+		y[i] = (T)((T)r >> (r % (sizeof(T) * 8)));
+		if (y[i] == 0)
+			y[i] = 1;
+	}
+
+	cl::Program prg(ctx, src);
+	const std::string def("-DTYPE=" + type);
+	try {
+		int ret = bench::build(prg, ctx, devices, bench::build_options(def));
+		if (ret != CL_SUCCESS) {
+			std::cout <<"BUILD FAIL" << std::endl;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Build failed:\n" << e.what() << " "
+			<< e.err() << std::endl;
+		std::cerr << "BUILD LOG:\n" <<
+			prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+			<< "\nLOG DONE\n";
+		return -1;
+	}
+
+	cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+	               count * sizeof(T), &x[0]);
+	cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+	               count * sizeof(T), &y[0]);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, count * sizeof(T));
+
+	double total = 0;
+	unsigned errors = 0;
+	for (unsigned op = 0; op < OPS; ++op) {
+		cl::Event ev;
+		try {
+			cl::Kernel kernel(prg, kernel_names[op]);
+			kernel.setArg(0, in1);
+			kernel.setArg(1, in2);
+			kernel.setArg(2, out);
+			kernel.setArg(3, (unsigned)count);
+
+			cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0),
+				cl::NDRange(count), cl::NullRange, NULL, &ev);
+			cmd.finish();
+			cmd.enqueueReadBuffer(out, true, 0,
+				count * sizeof(T), &results[0], 0);
+		} catch (cl::Error e) {
+			std::cerr << "Kernel failed: " << e.what() << " "
+				<< e.err() << std::endl;
+			return -1;
+		}
+		const double seconds = bench::event_seconds(ev);
+		total += seconds;
+		bench::report(type + " " + op_names[op], count, seconds,
+		              3 * count * sizeof(T));
+
+		unsigned op_errors = 0;
+		bench::perf::scope perf("verify", count);
+		bench::parallel_for(count, [&](size_t begin, size_t end) {
+			unsigned local_errors = 0;
+			for (size_t i = begin; i < end; ++i) {
+				const T result = host_op<T>(op, x[i], y[i]);
+				if (result == results[i])
+					continue;
+				++local_errors;
+				std::lock_guard<std::mutex> guard(bench::log_lock());
+				std::cerr << "Incorrect element(" << std::dec
+					<< i << "): " << x[i] << " "
+					<< op_names[op] << " " << y[i]
+					<< " result: " << results[i]
+					<< " correct: " << result << std::endl;
+			}
+			std::lock_guard<std::mutex> guard(bench::log_lock());
+			op_errors += local_errors;
+		});
+		std::cout << "Wrong " << type << " " << op_names[op] << ": "
+			<< op_errors << "/" << count << std::endl;
+		errors += op_errors;
+	}
+	return errors ? -1 : total;
+}
+
 int main(int argc, const char*argv[])
 {
 	(void) argv;
 	(void) argc;
+	bench::memory_reporter memory;
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -67,68 +210,29 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
-	cl::Program prg(ctx, src);
-	try {
-		int ret = prg.build(devices);
-		if (ret != CL_SUCCESS) {
-			std::cout <<"BUILD FAIL" << std::endl;
-		}
-	} catch (cl::Error e) {
-		std::cerr << "Build failed:\n" << e.what() << " "
-			<< e.err() << std::endl;
-		std::cerr << "BUILD LOG:\n" <<
-			prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
-			<< "\nLOG DONE\n";
-		return 1;
-	} catch (...) {
-		return 1;
-	}
 
-#ifdef SW
-	cl_uint result1[3];
-	cl::Buffer out1(ctx, CL_MEM_WRITE_ONLY, sizeof(result1));
-#endif
-#ifdef LONG
-	cl_ulong result2[3];
-	cl::Buffer out2(ctx, CL_MEM_WRITE_ONLY, sizeof(result2));
-#endif
-
-	/* Create kernel and set arguments */
+	double time32 = 0, time64 = 0;
+	const size_t count32 = element_count<cl_uint>(devices[0]);
+	const size_t count64 = element_count<cl_ulong>(devices[0]);
 	try {
+		bench::trace::phase("run");
 		/* Command queue */
-		cl::CommandQueue cmd(ctx, devices[0]);
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
 #ifdef SW
-		cl::Kernel kernel1(prg, "test1");
-		kernel1.setArg(0, (cl_uint)X);
-		kernel1.setArg(1, (cl_uint)Y);
-		kernel1.setArg(2, out1);
-
-		//todo: use this
-		cl::size_t<3> local;                // local domain size for our calculation
-		kernel1.getWorkGroupInfo(devices[0], CL_KERNEL_COMPILE_WORK_GROUP_SIZE, &local);
-		std::cout << "Local size is: " << local[2] << std::endl;
-
-
-		cmd.enqueueNDRangeKernel(kernel1, cl::NDRange(0), cl::NDRange(1), cl::NDRange(1));
-		cmd.finish();
-		cmd.enqueueReadBuffer(out1, true, 0, sizeof(result1), result1, 0);
+		time32 = run_type<cl_uint>(ctx, devices, cmd, src, "uint",
+		                           count32);
 #endif
 		::std::cerr << "===========================================\n";
 #ifdef LONG
-		/* test ulong */
-		cl::Kernel kernel2(prg, "test2");
-		kernel2.setArg(0, (cl_ulong)X);
-		kernel2.setArg(1, (cl_ulong)Y);
-		kernel2.setArg(2, out2);
-
-		cmd.enqueueNDRangeKernel(kernel2, cl::NDRange(0), cl::NDRange(1), cl::NDRange(1));
-		cmd.finish();
-		cmd.enqueueReadBuffer(out2, true, 0, sizeof(result2), result2, 0);
+		time64 = run_type<cl_ulong>(ctx, devices, cmd, src, "ulong",
+		                            count64);
 #endif
 	} catch (cl::Error e) {
 		std::cerr << "Kernel failed: " << e.what() << " "
@@ -137,15 +241,18 @@ int main(int argc, const char*argv[])
 	} catch (...) {
 		return 1;
 	}
+	if (time32 < 0 || time64 < 0)
+		return 1;
 #ifdef SW
-	std::cout << X << " MUL " << Y << " = " << result1[0] << std::endl;
-	std::cout << X << " DIV " << Y << " = " << result1[1] << std::endl;
-	std::cout << X << " MOD " << Y << " = " << result1[2] << std::endl;
+	bench::report("uint ops", OPS * count32, time32);
 #endif
 #ifdef LONG
-	std::cout << X << " MUL " << Y << " = " << result2[0] << std::endl;
-	std::cout << X << " DIV " << Y << " = " << result2[1] << std::endl;
-	std::cout << X << " MOD " << Y << " = " << result2[2] << std::endl;
+	bench::report("ulong ops", OPS * count64, time64);
+#endif
+#if defined(SW) && defined(LONG)
+	/* per element, the counts differ on small devices */
+	std::cout << "64-bit/32-bit time ratio: "
+		<< time64 / count64 / (time32 / count32) << std::endl;
 #endif
 	return 0;
 }
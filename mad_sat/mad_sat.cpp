@@ -1,43 +1,371 @@
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
 #include <climits>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
-const char kernelSource[] = "            \n" \
-"__kernel void mad_sat_test(             \n" \
-"   __global uint3* input1,              \n" \
-"   __global uint3* input2,              \n" \
-"   __global uint3* input3,              \n" \
-"   __global uint3* output)              \n" \
-"{                                       \n" \
-"   int i = get_global_id(0);            \n" \
-"   output[i] = mad_sat(input1[i], input2[i], input3[i]);          \n" \
-"}                                       \n" \
+#include "bench.h"
+#include "program.h"
+
+/* Built once per scalar type and vector width:
+ * -DSTYPE=<type> -DWIDTH=<n> [-DHAS_24]
+ * Data is flat scalar arrays, vloadn/vstoren keeps 3 wide vectors packed */
+const char kernelSource[] = "                                   \n" \
+"#define CAT_(a, b) a##b                                       \n" \
+"#define CAT(a, b) CAT_(a, b)                                  \n" \
+"#if WIDTH == 1                                                \n" \
+"#define LOAD(i, p) (p)[i]                                     \n" \
+"#define STORE(v, i, p) (p)[i] = (v)                           \n" \
+"#else                                                         \n" \
+"#define LOAD(i, p) CAT(vload, WIDTH)(i, p)                    \n" \
+"#define STORE(v, i, p) CAT(vstore, WIDTH)(v, i, p)            \n" \
+"#endif                                                        \n" \
+"#define TEST(name, expr)                                      \\\n" \
+"__kernel void name##_test(                                    \\\n" \
+"   __global const STYPE* input1,                              \\\n" \
+"   __global const STYPE* input2,                              \\\n" \
+"   __global const STYPE* input3,                              \\\n" \
+"   __global STYPE* output)                                    \\\n" \
+"{                                                             \\\n" \
+"   size_t i = get_global_id(0);                               \\\n" \
+"   STORE(expr, i, output);                                    \\\n" \
+"}                                                             \n" \
+"#define A LOAD(i, input1)                                     \n" \
+"#define B LOAD(i, input2)                                     \n" \
+"#define C LOAD(i, input3)                                     \n" \
+"TEST(add_sat, add_sat(A, B))                                  \n" \
+"TEST(sub_sat, sub_sat(A, B))                                  \n" \
+"TEST(mad_sat, mad_sat(A, B, C))                               \n" \
+"TEST(mul_hi, mul_hi(A, B))                                    \n" \
+"TEST(mad_hi, mad_hi(A, B, C))                                 \n" \
+"#ifdef HAS_24                                                 \n" \
+"TEST(mad24, mad24(A, B, C))                                   \n" \
+"TEST(mul24, mul24(A, B))                                      \n" \
+"#endif                                                        \n" \
 "\n";
 
 enum {
-	DATA_SIZE = 3,
+	MAX_ELEMENTS = 16 * 1024 * 1024,
+	MAX_BUFFER = 64 * 1024 * 1024,
+	MAX_REPORTED = 16,
 };
 
-int main(int argc, const char*argv[])
+enum op {
+	ADD_SAT, SUB_SAT, MAD_SAT, MUL_HI, MAD_HI, MAD24, MUL24, OPS,
+};
+
+static const char *op_names[OPS] = {
+	"add_sat", "sub_sat", "mad_sat", "mul_hi", "mad_hi", "mad24", "mul24",
+};
+
+static const unsigned widths[] = { 1, 2, 3, 4, 8, 16 };
+enum { WIDTHS = sizeof(widths) / sizeof(widths[0]) };
+
+/* wide: holds any product/sum of two T without overflow
+ * print: what to cast to for readable output
+ * has24: mad24/mul24 exist for this type */
+template<typename T> struct traits;
+template<> struct traits<cl_char> {
+	typedef cl_int wide; typedef long long print;
+	static const bool has24 = false;
+};
+template<> struct traits<cl_uchar> {
+	typedef cl_uint wide; typedef unsigned long long print;
+	static const bool has24 = false;
+};
+template<> struct traits<cl_short> {
+	typedef cl_int wide; typedef long long print;
+	static const bool has24 = false;
+};
+template<> struct traits<cl_ushort> {
+	typedef cl_uint wide; typedef unsigned long long print;
+	static const bool has24 = false;
+};
+template<> struct traits<cl_int> {
+	typedef cl_long wide; typedef long long print;
+	static const bool has24 = true;
+};
+template<> struct traits<cl_uint> {
+	typedef cl_ulong wide; typedef unsigned long long print;
+	static const bool has24 = true;
+};
+template<> struct traits<cl_long> {
+	typedef __int128 wide; typedef long long print;
+	static const bool has24 = false;
+};
+template<> struct traits<cl_ulong> {
+	typedef unsigned __int128 wide; typedef unsigned long long print;
+	static const bool has24 = false;
+};
+
+template<typename T>
+static inline T saturate(typename traits<T>::wide v)
 {
-	(void) argc;
-	(void) argv;
+	typedef typename traits<T>::wide W;
+	return (T)::std::min<W>(::std::max<W>(v,
+		::std::numeric_limits<T>::min()), ::std::numeric_limits<T>::max());
+}
 
-	cl_uint data1[DATA_SIZE];      // original data set given to device
-	cl_uint data2[DATA_SIZE];      // original data set given to device
-	cl_uint data3[DATA_SIZE];      // original data set given to device
-	cl_uint results[DATA_SIZE];    // results returned from device
+template<typename T, typename F>
+static void ref_loop(const T *a, const T *b, const T *c, T *out,
+                     size_t count, F f)
+{
+#pragma omp simd
+	for (size_t i = 0; i < count; ++i)
+		out[i] = f(a[i], b[i], c[i]);
+}
 
-        for(unsigned i = 0; i < DATA_SIZE; i++) {
-	        data1[i] = rand();
-	        data2[i] = rand();
-	        data3[i] = rand();
+/* Branch free host reference, each case is a plain loop over
+ * contiguous arrays so that it vectorizes. */
+template<typename T>
+static void reference(unsigned op, const T *a, const T *b, const T *c,
+                      T *out, size_t count)
+{
+	typedef typename traits<T>::wide W;
+	/* wrapping arithmetic in T without signed overflow */
+	typedef typename ::std::make_unsigned<T>::type U;
+	const unsigned bits = sizeof(T) * CHAR_BIT;
+	switch (op) {
+	case ADD_SAT:
+		ref_loop(a, b, c, out, count, [](T x, T y, T) {
+			return saturate<T>((W)x + (W)y); });
+		break;
+	case SUB_SAT:
+		/* wide is unsigned for unsigned T, x - y would wrap */
+		if (::std::numeric_limits<T>::is_signed)
+			ref_loop(a, b, c, out, count, [](T x, T y, T) {
+				return saturate<T>((W)x - (W)y); });
+		else
+			ref_loop(a, b, c, out, count, [](T x, T y, T) {
+				return (T)(x < y ? 0 : x - y); });
+		break;
+	case MAD_SAT:
+		ref_loop(a, b, c, out, count, [](T x, T y, T z) {
+			return saturate<T>((W)x * (W)y + (W)z); });
+		break;
+	case MUL_HI:
+		ref_loop(a, b, c, out, count, [bits](T x, T y, T) {
+			return (T)(((W)x * (W)y) >> bits); });
+		break;
+	case MAD_HI:
+		ref_loop(a, b, c, out, count, [bits](T x, T y, T z) {
+			return (T)(U)((U)(((W)x * (W)y) >> bits) + (U)z); });
+		break;
+	case MAD24:
+		ref_loop(a, b, c, out, count, [](T x, T y, T z) {
+			return (T)((W)x * (W)y + (W)z); });
+		break;
+	case MUL24:
+		ref_loop(a, b, c, out, count, [](T x, T y, T) {
+			return (T)((W)x * (W)y); });
+		break;
 	}
+}
+
+/* Samples densely around the saturation boundaries: extremes, zero and
+ * the square root of the range where products start to overflow. */
+template<typename T>
+static T sample(uint64_t &seed, unsigned bits)
+{
+	const bool is_signed = ::std::numeric_limits<T>::is_signed;
+	const uint64_t r = bench::rand64(seed);
+	const uint64_t small = (r >> 8) % 16;
+	const uint64_t mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+	/* all values are formed as bit patterns and truncated to bits */
+	const uint64_t max = is_signed ? mask >> 1 : mask;
+	const uint64_t min = is_signed ? ~(mask >> 1) : 0;
+	const uint64_t root = (uint64_t)::std::sqrt((double)max);
+	uint64_t v;
+	switch (r % 6) {
+	case 0: v = bench::rand64(seed); break;
+	case 1: v = max - small; break;
+	case 2: v = min + small; break;
+	case 3: v = small - (is_signed ? 8 : 0); break;
+	case 4: v = root + small - 8; break;
+	default: v = -(root + small - 8); break;
+	}
+	v &= mask;
+	/* sign extend values narrower than T (the 24-bit operands) */
+	if (is_signed && bits < 64 && (v >> (bits - 1)) & 1)
+		v |= ~mask;
+	return (T)v;
+}
 
+template<typename T>
+static unsigned verify(unsigned op, unsigned width, const T *a, const T *b,
+                       const T *c, const T *results, size_t count,
+                       const char *type)
+{
+	typedef typename traits<T>::print P;
+	::std::vector<T> expected(count);
+	unsigned errors = 0, reported = 0;
+	bench::perf::scope perf("verify", count);
+	bench::parallel_for(count, [&](size_t begin, size_t end) {
+		reference<T>(op, a + begin, b + begin, c + begin,
+		             &expected[begin], end - begin);
+		unsigned local_errors = 0;
+		for (size_t i = begin; i < end; ++i) {
+			if (expected[i] == results[i])
+				continue;
+			++local_errors;
+			::std::lock_guard< ::std::mutex> guard(bench::log_lock());
+			if (reported++ >= MAX_REPORTED)
+				continue;
+			::std::cerr << "Incorrect element(" << ::std::dec
+				<< i << ") " << op_names[op] << " " << type
+				<< width << ": " << (P)a[i] << ", " << (P)b[i]
+				<< ", " << (P)c[i]
+				<< " result: " << (P)results[i]
+				<< " correct: " << (P)expected[i] << ::std::endl;
+		}
+		::std::lock_guard< ::std::mutex> guard(bench::log_lock());
+		errors += local_errors;
+	});
+	return errors;
+}
+
+/* Runs every builtin for every vector width of scalar type T and prints
+ * a throughput table. Returns the number of wrong elements or -1 if the
+ * device failed. */
+template<typename T>
+static long run_type(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const cl::CommandQueue &cmd,
+                     const cl::Program::Sources &src,
+                     const ::std::string &type)
+{
+	const unsigned bits = sizeof(T) * CHAR_BIT;
+	const bool has24 = traits<T>::has24;
+	/* every width runs over the whole buffers, three or five inputs and
+	 * the output on the device, the host adds the expected values */
+	const size_t buffers = has24 ? 6 : 4;
+	const size_t max_elements = bench::fit_elements(devices[0],
+		::std::min<size_t>(MAX_ELEMENTS, MAX_BUFFER / sizeof(T)),
+		buffers * sizeof(T), sizeof(T), (buffers + 1) * sizeof(T),
+		widths[WIDTHS - 1]);
+
+	::std::vector<T> data1(max_elements), data2(max_elements);
+	::std::vector<T> data3(max_elements), results(max_elements);
+	::std::vector<T> data1_24, data2_24;
+	uint64_t seed = 0x2545F4914F6CDD1DULL + bits;
+	for (size_t i = 0; i < max_elements; ++i) {
+		data1[i] = sample<T>(seed, bits);
+		data2[i] = sample<T>(seed, bits);
+		data3[i] = sample<T>(seed, bits);
+	}
+	if (has24) {
+		data1_24.resize(max_elements);
+		data2_24.resize(max_elements);
+		for (size_t i = 0; i < max_elements; ++i) {
+			data1_24[i] = sample<T>(seed, 24);
+			data2_24[i] = sample<T>(seed, 24);
+		}
+	}
+
+	const size_t bytes = max_elements * sizeof(T);
+	cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data1[0]);
+	cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data2[0]);
+	cl::Buffer in3 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data3[0]);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+	cl::Buffer in1_24, in2_24;
+	if (has24) {
+		in1_24 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data1_24[0]);
+		in2_24 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data2_24[0]);
+	}
+
+	double rates[WIDTHS][OPS] = {};
+	long errors = 0;
+	for (unsigned w = 0; w < WIDTHS; ++w) {
+		const unsigned width = widths[w];
+		const size_t items = max_elements / width;
+		const size_t count = items * width;
+
+		cl::Program prg(ctx, src);
+		const ::std::string def("-DSTYPE=" + type + " -DWIDTH=" +
+			::std::to_string(width) + (has24 ? " -DHAS_24" : ""));
+		try {
+			int ret = bench::build(prg, ctx, devices, bench::build_options(def));
+			if (ret != CL_SUCCESS) {
+				::std::cout <<"BUILD FAIL" << ::std::endl;
+			}
+		} catch (cl::Error e) {
+			::std::cerr << "Build failed:\n" << e.what() << " "
+				<< e.err() << ::std::endl;
+			::std::cerr << "BUILD LOG:\n" <<
+				prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+				<< "\nLOG DONE\n";
+			return -1;
+		}
+
+		for (unsigned op = 0; op < OPS; ++op) {
+			const bool is24 = op == MAD24 || op == MUL24;
+			if (is24 && !has24)
+				continue;
+			const T *a = is24 ? &data1_24[0] : &data1[0];
+			const T *b = is24 ? &data2_24[0] : &data2[0];
+			cl::Event ev;
+			try {
+				cl::Kernel kernel(prg, (::std::string(op_names[op]) + "_test").c_str());
+				kernel.setArg(0, is24 ? in1_24 : in1);
+				kernel.setArg(1, is24 ? in2_24 : in2);
+				kernel.setArg(2, in3);
+				kernel.setArg(3, out);
+
+				cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0),
+					cl::NDRange(items), cl::NullRange,
+					NULL, &ev);
+				cmd.finish();
+				cmd.enqueueReadBuffer(out, true, 0,
+					count * sizeof(T), &results[0], 0);
+			} catch (cl::Error e) {
+				::std::cerr << "Kernel failed: " << e.what() << " "
+					<< e.err() << ::std::endl;
+				return -1;
+			}
+			rates[w][op] = count / bench::event_seconds(ev);
+			const unsigned wrong = verify<T>(op, width, a, b,
+				&data3[0], &results[0], count, type.c_str());
+			if (wrong)
+				::std::cout << "Wrong " << op_names[op] << " "
+					<< type << width << ": " << wrong
+					<< "/" << count << ::std::endl;
+			errors += wrong;
+		}
+	}
+
+	::std::cout << ::std::setw(10) << "Gop/s";
+	for (unsigned op = 0; op < OPS; ++op)
+		if (has24 || (op != MAD24 && op != MUL24))
+			::std::cout << ::std::setw(9) << op_names[op];
+	::std::cout << ::std::endl;
+	for (unsigned w = 0; w < WIDTHS; ++w) {
+		::std::cout << ::std::setw(10) << (type + (widths[w] == 1 ?
+			"" : ::std::to_string(widths[w])));
+		for (unsigned op = 0; op < OPS; ++op)
+			if (has24 || (op != MAD24 && op != MUL24))
+				::std::cout << ::std::setw(9) << ::std::fixed
+					<< ::std::setprecision(2)
+					<< rates[w][op] / 1e9;
+		::std::cout << ::std::endl;
+	}
+	return errors;
+}
+
+int main(int argc, const char*argv[])
+{
+	(void) argc;
+	(void) argv;
+	bench::memory_reporter memory;
+
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -65,54 +393,28 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
-	/* CL buffers to use as kernel arguments */
-	cl::Buffer in1(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data1), data1);
-	cl::Buffer in2(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data2), data2);
-	cl::Buffer in3(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data3), data3);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
-
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
-	cl::Program prg(ctx, src);
-	try {
-		int ret = prg.build(devices);
-		if (ret != CL_SUCCESS) {
-			std::cout <<"BUILD FAIL" << std::endl;
-		}
-	} catch (cl::Error e) {
-		std::cerr << "Build failed:\n" << e.what() << " "
-			<< e.err() << std::endl;
-		std::cerr << "BUILD LOG:\n" <<
-			prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
-			<< "\nLOG DONE\n";
-		return 1;
-	} catch (...) {
-		return 1;
-	}
 
-
-	/* Create kernel and set arguments */
+	long errors[8];
 	try {
-		cl::Kernel kernel(prg, "mad_sat_test");
-		kernel.setArg(0, in1);
-		kernel.setArg(1, in2);
-		kernel.setArg(2, in3);
-		kernel.setArg(3, out);
-
-		//todo: use this
-		cl::size_t<3> local;                // local domain size for our calculation
-		kernel.getWorkGroupInfo(devices[0], CL_KERNEL_COMPILE_WORK_GROUP_SIZE, &local);
-		std::cout << "Local size is: " << local[2] << std::endl;
-
+		bench::trace::phase("run");
 		/* Command queue */
-		cl::CommandQueue cmd(ctx, devices[0]);
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
 
-		cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0), cl::NDRange(1), cl::NDRange(1));
-		cmd.finish();
-		cmd.enqueueReadBuffer(out, true, 0, sizeof(results), results, 0);
+		errors[0] = run_type<cl_char>(ctx, devices, cmd, src, "char");
+		errors[1] = run_type<cl_uchar>(ctx, devices, cmd, src, "uchar");
+		errors[2] = run_type<cl_short>(ctx, devices, cmd, src, "short");
+		errors[3] = run_type<cl_ushort>(ctx, devices, cmd, src, "ushort");
+		errors[4] = run_type<cl_int>(ctx, devices, cmd, src, "int");
+		errors[5] = run_type<cl_uint>(ctx, devices, cmd, src, "uint");
+		errors[6] = run_type<cl_long>(ctx, devices, cmd, src, "long");
+		errors[7] = run_type<cl_ulong>(ctx, devices, cmd, src, "ulong");
 	} catch (cl::Error e) {
 		std::cerr << "Kernel failed: " << e.what() << " "
 			<< e.err() << std::endl;
@@ -120,19 +422,13 @@ int main(int argc, const char*argv[])
 	} catch (...) {
 		return 1;
 	}
-	unsigned errors1 = 0;
-	for (int i = 0; i < DATA_SIZE; ++i) {
-		cl_uint result = ::std::min<uint64_t>(
-		    (uint64_t) data1[i] * (uint64_t)data2[i] + (uint64_t)data3[i], UINT_MAX);
-		if (result != results[i]) {
-			++errors1;
-			std::cerr << "Incorrect element(" << std::dec
-				<< i << "): " << std::dec
-				<< data1[i] << " result: " << results[i]
-				<< " correct: " << result << std::endl;
-		}
-	}
 
-	std::cout << "Wrong1: " << errors1 << "/" << DATA_SIZE << std::endl;
+	long total = 0;
+	for (unsigned i = 0; i < 8; ++i) {
+		if (errors[i] < 0)
+			return 1;
+		total += errors[i];
+	}
+	std::cout << "Wrong: " << total << std::endl;
 	return 0;
 }
@@ -0,0 +1,149 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/* Memory footprint accounting and problem sizing. Device buffers and
+ * images made with bench::buffer(), image1d() and image2d() are added up,
+ * bench::fit_elements() picks how many elements one chunk of a test can
+ * use on this device and host, and bench::memory_reporter prints both
+ * footprints when main returns. BENCH_MEM_FRACTION (default 0.5) is the
+ * share of device and host memory a single test may take, lower it to
+ * run more tests side by side. Included by bench.h. */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace bench {
+
+static inline ::std::atomic<unsigned long long> &device_bytes()
+{
+	static ::std::atomic<unsigned long long> bytes(0);
+	return bytes;
+}
+
+/* cl::Buffer that is counted in the device footprint */
+static inline cl::Buffer buffer(const cl::Context &ctx, cl_mem_flags flags,
+                                size_t size, void *host_ptr = NULL)
+{
+	cl::Buffer b(ctx, flags, size, host_ptr);
+	device_bytes() += size;
+	return b;
+}
+
+/* Bytes per pixel of the formats the tests use, 0 if unknown */
+static inline size_t pixel_bytes(const cl::ImageFormat &format)
+{
+	size_t channels = 0, size = 0;
+	switch (format.image_channel_order) {
+	case CL_R: channels = 1; break;
+	case CL_RGBA:
+	case CL_BGRA: channels = 4; break;
+	}
+	switch (format.image_channel_data_type) {
+	case CL_UNORM_INT8:
+	case CL_UNSIGNED_INT8: size = 1; break;
+	case CL_HALF_FLOAT: size = 2; break;
+	case CL_FLOAT: size = 4; break;
+	}
+	return channels * size;
+}
+
+/* Images counted like bench::buffer() */
+static inline cl::Image1D image1d(const cl::Context &ctx, cl_mem_flags flags,
+                                  const cl::ImageFormat &format, size_t width,
+                                  void *host_ptr = NULL)
+{
+	cl::Image1D img(ctx, flags, format, width, host_ptr);
+	device_bytes() += width * pixel_bytes(format);
+	return img;
+}
+
+static inline cl::Image2D image2d(const cl::Context &ctx, cl_mem_flags flags,
+                                  const cl::ImageFormat &format, size_t width,
+                                  size_t height, void *host_ptr = NULL)
+{
+	cl::Image2D img(ctx, flags, format, width, height, 0, host_ptr);
+	device_bytes() += width * height * pixel_bytes(format);
+	return img;
+}
+
+static inline double mem_fraction()
+{
+	static const double fraction = [] {
+		const char *env = getenv("BENCH_MEM_FRACTION");
+		const double f = env ? atof(env) : 0.5;
+		return f > 0 && f <= 1 ? f : 0.5;
+	}();
+	return fraction;
+}
+
+/* Physical memory of the host, 0 if unknown */
+static inline unsigned long long host_memory()
+{
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	const long page_size = sysconf(_SC_PAGE_SIZE);
+	return pages > 0 && page_size > 0 ?
+		(unsigned long long)pages * page_size : 0;
+}
+
+static inline unsigned long long peak_rss()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage))
+		return 0;
+	/* kilobytes on Linux */
+	return (unsigned long long)usage.ru_maxrss * 1024;
+}
+
+/* Elements per chunk for a test that wants 'wanted' elements. Every
+ * element takes per_element device bytes over all its buffers, largest of
+ * them in the biggest buffer, and host_per_element bytes of host memory.
+ * The result is a multiple of 'multiple' unless wanted is smaller. */
+static inline size_t fit_elements(const cl::Device &dev, size_t wanted,
+                                  size_t per_element, size_t largest,
+                                  size_t host_per_element,
+                                  size_t multiple = 1)
+{
+	size_t fit = wanted;
+	const cl_ulong max_alloc = dev.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+	const cl_ulong global = dev.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+	if (largest)
+		fit = ::std::min<cl_ulong>(fit, max_alloc / largest);
+	if (per_element)
+		fit = ::std::min<cl_ulong>(fit,
+			global * mem_fraction() / per_element);
+	const unsigned long long host = host_memory();
+	if (host && host_per_element)
+		fit = ::std::min<unsigned long long>(fit,
+			host * mem_fraction() / host_per_element);
+	if (fit < wanted)
+		fit -= fit % multiple;
+	return ::std::max<size_t>(fit, ::std::min(wanted, multiple));
+}
+
+/* Footprint summary, printed at the end of a test */
+static inline void memory_report()
+{
+	::std::cout << "Memory: peak RSS " << peak_rss() / 1048576.0
+		<< " MiB, device buffers " << device_bytes() / 1048576.0
+		<< " MiB" << ::std::endl;
+}
+
+/* Prints memory_report() on every way out of the scope, one at the top
+ * of main covers the mode dispatch and early returns */
+class memory_reporter {
+public:
+	memory_reporter() {}
+	~memory_reporter() { memory_report(); }
+private:
+	memory_reporter(const memory_reporter &);
+	memory_reporter &operator=(const memory_reporter &);
+};
+
+}
+
+#endif
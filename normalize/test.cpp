@@ -1,5 +1,8 @@
 #include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <numeric>
+#include <string>
 #include <vector>
 
 
@@ -7,6 +10,8 @@
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
 
 /* Can use float, float2, float3, and float4 */
 const char kernelSource[] = "            \n" \
@@ -22,23 +27,455 @@ const char kernelSource[] = "            \n" \
 "}                                       \n" \
 "\n";
 
+/* Variant comparison, built per width with -DWIDTH=2, 3 or 4 */
+const char variantSource[] = "                                \n" \
+"#define CAT_(a, b) a##b                                       \n" \
+"#define CAT(a, b) CAT_(a, b)                                  \n" \
+"typedef CAT(float, WIDTH) type;                               \n" \
+"#define TEST(name, expr)                                      \\\n" \
+"__kernel void name(                                           \\\n" \
+"   __global const type *input,                                \\\n" \
+"   __global type *output,                                     \\\n" \
+"   unsigned int count)                                        \\\n" \
+"{                                                             \\\n" \
+"   size_t i = get_global_id(0);                               \\\n" \
+"   if (i >= count)                                            \\\n" \
+"      return;                                                 \\\n" \
+"   type x = input[i];                                         \\\n" \
+"   output[i] = expr;                                          \\\n" \
+"}                                                             \n" \
+"TEST(norm_builtin, normalize(x))                              \n" \
+"TEST(norm_fast, fast_normalize(x))                            \n" \
+"TEST(norm_rsqrt, x * rsqrt(dot(x, x)))                        \n" \
+"TEST(norm_native_rsqrt, x * native_rsqrt(dot(x, x)))          \n" \
+"\n";
+
+/* float3 layouts, built with -DNORM=normalize or fast_normalize.
+ * padded: float3 array, 16 bytes per vector
+ * packed: tightly packed xyz floats accessed with vload3/vstore3
+ * soa: separate x, y and z arrays */
+const char layoutSource[] = "                                 \n" \
+"__kernel void norm3_padded(                                   \n" \
+"   __global const float3 *input,                              \n" \
+"   __global float3 *output,                                   \n" \
+"   unsigned int count)                                        \n" \
+"{                                                             \n" \
+"   size_t i = get_global_id(0);                               \n" \
+"   if (i < count)                                             \n" \
+"      output[i] = NORM(input[i]);                             \n" \
+"}                                                             \n" \
+"__kernel void norm3_packed(                                   \n" \
+"   __global const float *input,                               \n" \
+"   __global float *output,                                    \n" \
+"   unsigned int count)                                        \n" \
+"{                                                             \n" \
+"   size_t i = get_global_id(0);                               \n" \
+"   if (i < count)                                             \n" \
+"      vstore3(NORM(vload3(i, input)), i, output);             \n" \
+"}                                                             \n" \
+"__kernel void norm3_soa(                                      \n" \
+"   __global const float *x,                                   \n" \
+"   __global const float *y,                                   \n" \
+"   __global const float *z,                                   \n" \
+"   __global float *out_x,                                     \n" \
+"   __global float *out_y,                                     \n" \
+"   __global float *out_z,                                     \n" \
+"   unsigned int count)                                        \n" \
+"{                                                             \n" \
+"   size_t i = get_global_id(0);                               \n" \
+"   if (i >= count)                                            \n" \
+"      return;                                                 \n" \
+"   float3 v = NORM((float3)(x[i], y[i], z[i]));               \n" \
+"   out_x[i] = v.x;                                            \n" \
+"   out_y[i] = v.y;                                            \n" \
+"   out_z[i] = v.z;                                            \n" \
+"}                                                             \n" \
+"\n";
+
 enum {
 	DATA_SIZE = 60,
+	/* variant comparison */
+	VARIANT_VECTORS = 4 * 1024 * 1024,
+	VARIANT_RUNS = 5,
+	/* float3 layout comparison */
+	LAYOUT_VECTORS = 8 * 1024 * 1024,
+	LAYOUT_RUNS = 5,
+	MAX_REPORTED = 16,
+};
+
+static const char *variant_names[] = {
+	"normalize", "fast_normalize", "rsqrt", "native_rsqrt",
+};
+static const char *variant_kernels[] = {
+	"norm_builtin", "norm_fast", "norm_rsqrt", "norm_native_rsqrt",
 };
+enum { VARIANTS = sizeof(variant_names) / sizeof(variant_names[0]) };
+/* Allowed ULP per component is this plus the vector width: the spec's
+ * 2 + n for normalize, held to rsqrt as well since normalize is x times
+ * rsqrt of the dot product. fast_ and native_ have no bound and are only
+ * reported. */
+static const double variant_ulps[] = { 2, INFINITY, 2, INFINITY };
 
 float square_accum(float old, float new_val)
 {
 	return old + (new_val * new_val);
 }
 
-int main(void)
+/* Accuracy of one variant against a double precision reference */
+struct accuracy {
+	double max_ulp;
+	double max_length_error;
+	unsigned non_finite;
+};
+
+static accuracy check_vectors(const float *data, const float *results,
+                              size_t vectors, unsigned size, unsigned stride,
+                              const std::string &what)
+{
+	accuracy acc = { 0, 0, 0 };
+	unsigned reported = 0;
+	bench::perf::scope perf("verify", vectors);
+	bench::parallel_for(vectors, [&](size_t begin, size_t end) {
+		accuracy local = { 0, 0, 0 };
+		for (size_t v = begin; v < end; ++v) {
+			const float *in = data + v * stride;
+			const float *out = results + v * stride;
+			double dot = 0, out_dot = 0;
+			for (unsigned c = 0; c < size; ++c) {
+				dot += (double)in[c] * in[c];
+				out_dot += (double)out[c] * out[c];
+			}
+			const double length = std::sqrt(dot);
+			double ulp = 0;
+			for (unsigned c = 0; c < size; ++c)
+				ulp = std::max(ulp, bench::ulp_error(out[c],
+				                                     in[c] / length));
+			const double length_error = std::fabs(std::sqrt(out_dot) - 1.0);
+			if (!std::isfinite(ulp) || !std::isfinite(length_error)) {
+				++local.non_finite;
+				std::lock_guard<std::mutex> guard(bench::log_lock());
+				if (reported++ < MAX_REPORTED)
+					std::cerr << "Incorrect element(" << v << ") "
+						<< what << ": " << in[0] << " result: "
+						<< out[0] << " correct: "
+						<< in[0] / length << std::endl;
+				continue;
+			}
+			local.max_ulp = std::max(local.max_ulp, ulp);
+			local.max_length_error =
+				std::max(local.max_length_error, length_error);
+		}
+		std::lock_guard<std::mutex> guard(bench::log_lock());
+		acc.max_ulp = std::max(acc.max_ulp, local.max_ulp);
+		acc.max_length_error =
+			std::max(acc.max_length_error, local.max_length_error);
+		acc.non_finite += local.non_finite;
+	});
+	return acc;
+}
+
+/* normalize, fast_normalize and the rsqrt based versions for float2/3/4,
+ * built with options. All of them read the same input buffer, float3
+ * uses the padded four float layout. normalize and rsqrt fail above
+ * variant_ulps. If summary is given a CSV row per kernel is appended
+ * to it. */
+static int run_variants(const cl::Context &ctx,
+                        const std::vector<cl::Device> &devices,
+                        const std::string &options = "",
+                        std::vector<std::string> *summary = NULL)
+{
+	/* in and out take four floats per vector, so do data and results */
+	const size_t vectors = bench::fit_elements(devices[0],
+		VARIANT_VECTORS, 8 * sizeof(float), 4 * sizeof(float),
+		8 * sizeof(float));
+	if (vectors < VARIANT_VECTORS)
+		std::cout << "Device memory fits " << vectors << " vectors"
+			<< std::endl;
+	/* Components span a few orders of magnitude so the squared length
+	 * stays well inside float range */
+	std::vector<float> data(vectors * 4), results(vectors * 4);
+	uint64_t seed = 0x3c6ef372fe94f82bULL;
+	for (size_t i = 0; i < data.size(); ++i) {
+		const float scale = std::pow(10.0f,
+			(float)(bench::rand64(seed) % 7) - 3.0f);
+		data[i] = (bench::randf(seed) * 2.0f - 1.0f) * scale;
+	}
+	const size_t bytes = data.size() * sizeof(float);
+
+	cl::Program::Sources src(1,
+		std::make_pair(variantSource, std::strlen(variantSource)));
+	unsigned errors = 0;
+	try {
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			bytes, &data[0]);
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+
+		for (unsigned size:{2,3,4}) {
+			const unsigned stride = (size == 3) ? 4 : size;
+			const std::string type("float" + std::to_string(size));
+			cl::Program prg(ctx, src);
+			const std::string def("-DWIDTH=" + std::to_string(size) +
+				" " + options);
+			try {
+				const int ret = bench::build(prg, ctx, devices, bench::build_options(def));
+				if (ret != CL_SUCCESS) {
+					std::cout <<"BUILD FAIL" << std::endl;
+				}
+			} catch (cl::Error e) {
+				std::cerr << "Build failed:\n" << e.what() << " "
+					<< e.err() << std::endl;
+				std::cerr << "BUILD LOG:\n" <<
+					prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+					<< "\nLOG DONE\n";
+				return 1;
+			}
+
+			for (unsigned v = 0; v < VARIANTS; ++v) {
+				const std::string what = type + " " + variant_names[v];
+				cl::Kernel kernel(prg, variant_kernels[v]);
+				kernel.setArg(0, in);
+				kernel.setArg(1, out);
+				kernel.setArg(2, (unsigned)vectors);
+
+				const double best = bench::best_time(cmd, kernel,
+					cl::NDRange(vectors), cl::NullRange,
+					VARIANT_RUNS);
+				cmd.enqueueReadBuffer(out, true, 0,
+					vectors * stride * sizeof(float),
+					&results[0]);
+
+				const accuracy acc = check_vectors(&data[0],
+					&results[0], vectors, size, stride,
+					what);
+				const double max_ulp = variant_ulps[v] + size;
+				std::cout << what << ": max ULP " << acc.max_ulp
+					<< ", max length error "
+					<< acc.max_length_error << std::endl;
+				if (acc.max_ulp > max_ulp) {
+					std::cout << "Wrong " << what << ": max ULP "
+						<< acc.max_ulp << " above " << max_ulp
+						<< std::endl;
+					++errors;
+				}
+				bench::report(what, vectors, best,
+					2 * vectors * stride * sizeof(float));
+				if (summary)
+					summary->push_back(what + ", " +
+						std::to_string(vectors / best / 1e6) +
+						", " + std::to_string(acc.max_ulp) + ", " +
+						std::to_string(acc.max_length_error) + ", " +
+						std::to_string(acc.non_finite));
+				if (acc.non_finite)
+					std::cout << "Wrong " << what << ": "
+						<< acc.non_finite << "/"
+						<< vectors << std::endl;
+				errors += acc.non_finite;
+			}
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+/* run_variants once per compile option set, only the default set
+ * decides the exit code */
+static int run_matrix(const cl::Context &ctx,
+                      const std::vector<cl::Device> &devices)
+{
+	std::vector<std::string> summary;
+	int ret = 0;
+	for (unsigned o = 0; o < bench::OPTION_SETS; ++o) {
+		std::cout << "Options: " << bench::option_sets[o].name << std::endl;
+		std::vector<std::string> rows;
+		const int r = run_variants(ctx, devices,
+			bench::option_sets[o].options, &rows);
+		if (r && o == 0)
+			ret = r;
+		for (const std::string &row:rows)
+			summary.push_back(std::string(bench::option_sets[o].name) +
+				", " + row);
+	}
+	std::cout << "options, variant, M/s, max ULP, max length error, "
+		"non-finite" << std::endl;
+	for (const std::string &row:summary)
+		std::cout << row << std::endl;
+	return ret;
+}
+
+/* Padded float3, packed vload3/vstore3 and SoA layouts of the same
+ * LAYOUT_VECTORS vectors, or as many as fit, with normalize and
+ * fast_normalize */
+static int run_layouts(const cl::Context &ctx,
+                       const std::vector<cl::Device> &devices)
+{
+	/* padded, packed and SoA copies of the input and the outputs, 17
+	 * floats per vector on the device and on the host */
+	const size_t count = bench::fit_elements(devices[0], LAYOUT_VECTORS,
+		17 * sizeof(float), 4 * sizeof(float), 17 * sizeof(float));
+	if (count < LAYOUT_VECTORS)
+		std::cout << "Device memory fits " << count << " vectors"
+			<< std::endl;
+	std::vector<float> packed(count * 3), padded(count * 4, 0.0f);
+	std::vector<float> soa(count * 3);
+	uint64_t seed = 0x510e527fade682d1ULL;
+	for (size_t i = 0; i < count; ++i)
+	for (unsigned c = 0; c < 3; ++c) {
+		const float value = bench::randf(seed) * 20.0f - 10.0f;
+		packed[i * 3 + c] = value;
+		padded[i * 4 + c] = value;
+		soa[c * count + i] = value;
+	}
+	std::vector<float> results(count * 4), soa_results(count * 3);
+
+	cl::Program::Sources src(1,
+		std::make_pair(layoutSource, std::strlen(layoutSource)));
+	unsigned errors = 0;
+	try {
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		const size_t plane = count * sizeof(float);
+		cl::Buffer padded_in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			4 * plane, &padded[0]);
+		cl::Buffer packed_in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			3 * plane, &packed[0]);
+		cl::Buffer x = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			plane, &soa[0]);
+		cl::Buffer y = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			plane, &soa[count]);
+		cl::Buffer z = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			plane, &soa[2 * count]);
+		/* padded output is also used by packed, x/y/z by soa */
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, 4 * plane);
+		cl::Buffer out_x = bench::buffer(ctx, CL_MEM_WRITE_ONLY, plane);
+		cl::Buffer out_y = bench::buffer(ctx, CL_MEM_WRITE_ONLY, plane);
+		cl::Buffer out_z = bench::buffer(ctx, CL_MEM_WRITE_ONLY, plane);
+
+		for (const char *norm:{"normalize", "fast_normalize"}) {
+			cl::Program prg(ctx, src);
+			const std::string def("-DNORM=" + std::string(norm));
+			try {
+				const int ret = bench::build(prg, ctx, devices, bench::build_options(def));
+				if (ret != CL_SUCCESS) {
+					std::cout <<"BUILD FAIL" << std::endl;
+				}
+			} catch (cl::Error e) {
+				std::cerr << "Build failed:\n" << e.what() << " "
+					<< e.err() << std::endl;
+				std::cerr << "BUILD LOG:\n" <<
+					prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+					<< "\nLOG DONE\n";
+				return 1;
+			}
+
+			cl::Kernel k_padded(prg, "norm3_padded");
+			k_padded.setArg(0, padded_in);
+			k_padded.setArg(1, out);
+			k_padded.setArg(2, (unsigned)count);
+			const double t_padded = bench::best_time(cmd, k_padded,
+				cl::NDRange(count), cl::NullRange, LAYOUT_RUNS);
+			cmd.enqueueReadBuffer(out, true, 0, 4 * plane, &results[0]);
+			const accuracy a_padded = check_vectors(&padded[0],
+				&results[0], count, 3, 4, "padded");
+
+			cl::Kernel k_packed(prg, "norm3_packed");
+			k_packed.setArg(0, packed_in);
+			k_packed.setArg(1, out);
+			k_packed.setArg(2, (unsigned)count);
+			const double t_packed = bench::best_time(cmd, k_packed,
+				cl::NDRange(count), cl::NullRange, LAYOUT_RUNS);
+			cmd.enqueueReadBuffer(out, true, 0, 3 * plane, &results[0]);
+			const accuracy a_packed = check_vectors(&packed[0],
+				&results[0], count, 3, 3, "packed");
+
+			cl::Kernel k_soa(prg, "norm3_soa");
+			k_soa.setArg(0, x);
+			k_soa.setArg(1, y);
+			k_soa.setArg(2, z);
+			k_soa.setArg(3, out_x);
+			k_soa.setArg(4, out_y);
+			k_soa.setArg(5, out_z);
+			k_soa.setArg(6, (unsigned)count);
+			const double t_soa = bench::best_time(cmd, k_soa,
+				cl::NDRange(count), cl::NullRange, LAYOUT_RUNS);
+			cmd.enqueueReadBuffer(out_x, true, 0, plane, &soa_results[0]);
+			cmd.enqueueReadBuffer(out_y, true, 0, plane, &soa_results[count]);
+			cmd.enqueueReadBuffer(out_z, true, 0, plane, &soa_results[2 * count]);
+			for (size_t i = 0; i < count; ++i)
+			for (unsigned c = 0; c < 3; ++c)
+				results[i * 3 + c] = soa_results[c * count + i];
+			const accuracy a_soa = check_vectors(&packed[0],
+				&results[0], count, 3, 3, "soa");
+
+			const struct {
+				const char *name;
+				double seconds;
+				size_t bytes;
+				const accuracy &acc;
+			} rows[] = {
+				{ "padded", t_padded, 8 * plane, a_padded },
+				{ "packed", t_packed, 6 * plane, a_packed },
+				{ "soa", t_soa, 6 * plane, a_soa },
+			};
+			for (const auto &row:rows) {
+				const std::string what = std::string("float3 ") +
+					row.name + " " + norm;
+				bench::report(what, count, row.seconds, row.bytes);
+				std::cout << what << ": max ULP " << row.acc.max_ulp
+					<< ", max length error "
+					<< row.acc.max_length_error << ", "
+					<< t_padded / row.seconds
+					<< "x padded" << std::endl;
+				if (row.acc.non_finite)
+					std::cout << "Wrong " << what << ": "
+						<< row.acc.non_finite << "/"
+						<< count << std::endl;
+				errors += row.acc.non_finite;
+			}
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+int main(int argc, const char*argv[])
 {
+	bench::memory_reporter memory;
+	/* --variants compares normalize implementations on a large input,
+	 * --layouts compares padded, packed and SoA float3 storage,
+	 * --matrix runs --variants once per compile option set,
+	 * without arguments runs the exact check below */
+	bool variants = false, layouts = false, matrix = false;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--variants") {
+			variants = true;
+		} else if (arg == "--layouts") {
+			layouts = true;
+		} else if (arg == "--matrix") {
+			matrix = true;
+		} else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+
 	float data[DATA_SIZE];       // original data set given to device
 	float results[DATA_SIZE];    // results returned from device
 
+	bench::perf::scope perf_input("input", DATA_SIZE);
         for(unsigned i = 0; i < DATA_SIZE; i++)
 	        data[i] = rand() / (float)(RAND_MAX / 10);
+	perf_input.end();
 
+	bench::trace::phase("platform");
 	std::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -66,13 +503,25 @@ int main(void)
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
+	/* the modes build and run their own programs */
+	if (matrix || layouts || variants)
+		bench::trace::phase("run");
+	if (matrix)
+		return run_matrix(ctx, devices);
+	if (layouts)
+		return run_layouts(ctx, devices);
+	if (variants)
+		return run_variants(ctx, devices);
+
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer in(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
+	cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1,
 		std::make_pair(kernelSource, std::strlen(kernelSource)));
@@ -85,7 +534,7 @@ int main(void)
 
 		cl::Program prg(ctx, src);
 		try {
-			const int ret = prg.build(devices, def.c_str());
+			const int ret = bench::build(prg, ctx, devices, bench::build_options(def));
 			if (ret != CL_SUCCESS) {
 				std::cout <<"BUILD FAIL" << std::endl;
 			}
@@ -101,6 +550,7 @@ int main(void)
 		}
 
 
+		bench::trace::phase("run");
 		/* Create kernel and set arguments */
 		try {
 			cl::Kernel kernel(prg, "norm");
@@ -129,6 +579,7 @@ int main(void)
 			return 1;
 		}
 		unsigned errors = 0;
+		bench::perf::scope perf_verify("verify", DATA_SIZE);
 		for (int i = 0; i < DATA_SIZE; ++i) {
 			if (size == 3 && (i % 4 == 3))
 				continue;
@@ -150,6 +601,7 @@ int main(void)
 					<< " length: " << real_length << std::endl;
 			}
 		}
+		perf_verify.end();
 
 		std::cout << "Wrong: " << errors << "/" << DATA_SIZE << std::endl;
 	}
@@ -0,0 +1,164 @@
+#ifndef PERF_H
+#define PERF_H
+
+/* Hardware counters around host phases, enabled with BENCH_PERF=1.
+ * bench::perf::scope counts user space cycles, instructions, cache
+ * misses (the generic event, last level on most cores) and branch misses
+ * of this thread and of the threads it starts meanwhile (parallel_for),
+ * and prints them per element when it ends. If perf_event_open is not
+ * permitted or an event is missing, a note is printed once and the
+ * affected numbers are left out. Included by bench.h. */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+namespace perf {
+
+enum counter { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, COUNTERS };
+
+static inline bool enabled()
+{
+	static const bool on = getenv("BENCH_PERF") != NULL;
+	return on;
+}
+
+#ifdef __linux__
+static inline int open_counter(unsigned c)
+{
+	static const unsigned long long configs[COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES,
+	};
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = configs[c];
+	attr.disabled = 1;
+	/* user space only, allowed with perf_event_paranoid <= 2 */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	/* children are the parallel_for workers */
+	attr.inherit = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	                   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1,
+	               PERF_FLAG_FD_CLOEXEC);
+}
+#endif
+
+/* Prints why counting does not work, only the first time */
+static inline void unavailable(const char *what, int err)
+{
+	static bool told = false;
+	if (told)
+		return;
+	told = true;
+	::std::cerr << "perf: " << what << " not available: " << strerror(err)
+		<< (err == EACCES || err == EPERM ?
+		    " (see /proc/sys/kernel/perf_event_paranoid)" : "")
+		<< ::std::endl;
+}
+
+/* Counters from construction to end() or destruction, name must be a
+ * literal */
+class scope {
+public:
+	scope(const char *name, size_t elements)
+		: name(name), elements(elements)
+	{
+		for (unsigned c = 0; c < COUNTERS; ++c)
+			fds[c] = -1;
+		if (!enabled())
+			return;
+#ifdef __linux__
+		static const char *names[COUNTERS] = {
+			"cycles", "instructions", "cache misses", "branch misses"
+		};
+		for (unsigned c = 0; c < COUNTERS; ++c) {
+			fds[c] = open_counter(c);
+			if (fds[c] < 0)
+				unavailable(names[c], errno);
+		}
+		for (unsigned c = 0; c < COUNTERS; ++c)
+			if (fds[c] >= 0)
+				ioctl(fds[c], PERF_EVENT_IOC_ENABLE, 0);
+#else
+		unavailable("perf_event_open", ENOSYS);
+#endif
+	}
+	~scope() { end(); }
+
+	/* Stops counting and prints, for phases shorter than the block */
+	void end()
+	{
+		double counts[COUNTERS];
+		bool any = false;
+		for (unsigned c = 0; c < COUNTERS; ++c) {
+			counts[c] = read_counter(c);
+			any |= counts[c] >= 0;
+		}
+		if (!any || !elements)
+			return;
+		static const char *units[COUNTERS] = {
+			" cycles/elem", " instr/elem", " LLC misses/elem",
+			" branch misses/elem"
+		};
+		::std::cout << "perf " << name << ":";
+		const char *sep = " ";
+		for (unsigned c = 0; c < COUNTERS; ++c) {
+			if (counts[c] < 0)
+				continue;
+			::std::cout << sep << counts[c] / elements << units[c];
+			sep = ", ";
+			if (c == INSTRUCTIONS && counts[CYCLES] > 0)
+				::std::cout << ", IPC "
+					<< counts[INSTRUCTIONS] / counts[CYCLES];
+		}
+		::std::cout << ::std::endl;
+	}
+private:
+	scope(const scope &);
+	scope &operator=(const scope &);
+
+	/* Count scaled for multiplexing and closes the counter, -1 if the
+	 * counter never ran */
+	double read_counter(unsigned c)
+	{
+		if (fds[c] < 0)
+			return -1;
+		double count = -1;
+#ifdef __linux__
+		ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+		unsigned long long values[3];
+		if (read(fds[c], values, sizeof(values)) == sizeof(values) &&
+		    values[2])
+			count = values[0] * ((double)values[1] / values[2]);
+		close(fds[c]);
+#endif
+		fds[c] = -1;
+		return count;
+	}
+
+	const char *name;
+	size_t elements;
+	int fds[COUNTERS];
+};
+
+}
+}
+
+#endif
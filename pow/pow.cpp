@@ -1,10 +1,16 @@
+#include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+
 #define VECTOR
 
 // Simple compute kernel which computes the square of an input array
@@ -15,33 +21,357 @@ const char kernelSource[] = "            \n" \
 "   __global float* output)              \n" \
 "{                                       \n" \
 "   int i = get_global_id(0);            \n" \
-"   output[i] = pow(input[i], 2.0);      \n" \
+"   output[i] = pow(input[i], 2.0f);     \n" \
 "}                                       \n" \
 "__kernel void pow_vec_test(             \n" \
 "   __global float4* input,              \n" \
 "   __global float4* output)             \n" \
 "{                                       \n" \
 "   int i = get_global_id(0);            \n" \
-"   output[i] = pow(input[i], 2.0);      \n" \
+"   output[i] = pow(input[i], 2.0f);     \n" \
 "}                                       \n" \
 "\n";
 
+/* pow family suite. Every kernel reads x, y and n, the *_2 kernels
+ * use a literal exponent of 2 to show how the compiler lowers it. */
+const char suiteSource[] = "                                  \n" \
+"#define TEST(name, expr)                                      \\\n" \
+"__kernel void name(                                           \\\n" \
+"   __global const float *x,                                   \\\n" \
+"   __global const float *y,                                   \\\n" \
+"   __global const int *n,                                     \\\n" \
+"   __global float *output,                                    \\\n" \
+"   unsigned count)                                            \\\n" \
+"{                                                             \\\n" \
+"   size_t i = get_global_id(0);                               \\\n" \
+"   if (i < count)                                             \\\n" \
+"      output[i] = expr;                                       \\\n" \
+"}                                                             \n" \
+"TEST(pow_xy, pow(x[i], y[i]))                                 \n" \
+"TEST(pown_xn, pown(x[i], n[i]))                               \n" \
+"TEST(powr_xy, powr(x[i], y[i]))                               \n" \
+"TEST(native_powr_xy, native_powr(x[i], y[i]))                 \n" \
+"TEST(pow_2, pow(x[i], 2.0f))                                  \n" \
+"TEST(pown_2, pown(x[i], 2))                                   \n" \
+"TEST(powr_2, powr(x[i], 2.0f))                                \n" \
+"TEST(native_powr_2, native_powr(x[i], 2.0f))                  \n" \
+"TEST(mul_2, x[i] * x[i])                                      \n" \
+"\n";
+
 enum {
 	DATA_SIZE = 64,
+	/* suite mode */
+	SUITE_SIZE = 16 * 1024 * 1024,
+	SUITE_RUNS = 5,
+	MAX_REPORTED = 16,
 };
 
+enum func { POW, POWN, POWR, NATIVE_POWR, MUL };
+
+static const struct {
+	const char *kernel;
+	const char *name;
+	func f;
+	bool square;
+	/* allowed error, full profile limits, native_* is only reported */
+	double max_ulp;
+} suite[] = {
+	{ "pow_xy", "pow(x, y)", POW, false, 16 },
+	{ "pown_xn", "pown(x, n)", POWN, false, 16 },
+	{ "powr_xy", "powr(x, y)", POWR, false, 16 },
+	{ "native_powr_xy", "native_powr(x, y)", NATIVE_POWR, false, INFINITY },
+	{ "pow_2", "pow(x, 2.0f)", POW, true, 16 },
+	{ "pown_2", "pown(x, 2)", POWN, true, 16 },
+	{ "powr_2", "powr(x, 2.0f)", POWR, true, 16 },
+	{ "native_powr_2", "native_powr(x, 2.0f)", NATIVE_POWR, true, INFINITY },
+	{ "mul_2", "x * x", MUL, true, 0.5 },
+};
+enum { SUITE = sizeof(suite) / sizeof(suite[0]) };
+
+/* powr is pow restricted to x >= 0 with its own special cases */
+static double powr_reference(double x, double y)
+{
+	if (std::isnan(x) || std::isnan(y) || x < 0)
+		return NAN;
+	if (x == 0 && y == 0)
+		return NAN;
+	if (std::isinf(x) && y == 0)
+		return NAN;
+	if (x == 1 && std::isinf(y))
+		return NAN;
+	if (x == 0 && y < 0)
+		return INFINITY;
+	/* +0 for either zero, std::pow keeps the sign for odd y */
+	if (x == 0 && y > 0)
+		return 0.0;
+	return std::pow(x, y);
+}
+
+static double reference(func f, float x, float y, int n)
+{
+	switch (f) {
+	case POW: return std::pow((double)x, (double)y);
+	case POWN: return std::pow((double)x, (double)n);
+	case MUL: return (double)x * x;
+	default: return powr_reference(x, y);
+	}
+}
+
+/* Exact for NaN, infinities and signed zeros, ULP bound otherwise */
+static bool special_ok(float result, double expected, double max_ulp)
+{
+	if (std::isnan(expected))
+		return std::isnan(result);
+	if (std::isinf(expected) || expected == 0)
+		return (double)result == expected &&
+			std::signbit(result) == std::signbit(expected);
+	return bench::ulp_error(result, expected) <= max_ulp;
+}
+
+/* Per kernel results of one suite run, for the option matrix */
+struct suite_row {
+	double seconds;
+	double max_ulp;
+	unsigned special_pass;
+	unsigned specials;
+};
+
+/* Runs every suite kernel over SUITE_SIZE generic inputs (mixed sign
+ * and magnitude bases, exponents in [-8, 8], integral for negative
+ * bases) and over the special value grid, built with options. Reports
+ * max ULP, special case failures and throughput, and fills rows. */
+static int run_suite(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const std::string &options, suite_row *rows)
+{
+	std::vector<float> x(SUITE_SIZE), y(SUITE_SIZE), results(SUITE_SIZE);
+	std::vector<int> n(SUITE_SIZE);
+	uint64_t seed = 0xa54ff53a5f1d36f1ULL;
+	for (unsigned i = 0; i < SUITE_SIZE; ++i) {
+		const float magnitude = std::exp2(bench::randf(seed) * 16.0f - 8.0f);
+		x[i] = (bench::rand64(seed) & 1) ? -magnitude : magnitude;
+		y[i] = bench::randf(seed) * 16.0f - 8.0f;
+		if (x[i] < 0)
+			y[i] = std::rint(y[i]);
+		n[i] = (int)std::rint(y[i]);
+	}
+
+	/* Special value grid, n follows y where y is a finite integer */
+	const float sx[] = { 0.0f, -0.0f, 1.0f, -1.0f, 0.5f, -0.5f, 2.0f,
+		-2.0f, INFINITY, -INFINITY, NAN };
+	/* odd y pin down -0: pow(-0, odd) is -0, powr(-0, odd) is +0 */
+	const float sy[] = { 0.0f, -0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 3.0f,
+		-3.0f, 5.0f, -5.0f, 0.5f, -0.5f, INFINITY, -INFINITY, NAN };
+	std::vector<float> spec_x, spec_y;
+	std::vector<int> spec_n;
+	for (float a:sx)
+	for (float b:sy) {
+		spec_x.push_back(a);
+		spec_y.push_back(b);
+		spec_n.push_back(std::isfinite(b) && std::rint(b) == b ? (int)b : 0);
+	}
+	const unsigned specials = spec_x.size();
+	std::vector<float> spec_results(specials);
+
+	double seconds[SUITE];
+	unsigned errors = 0;
+	try {
+		cl::Program::Sources src(1,
+			std::make_pair(suiteSource, std::strlen(suiteSource)));
+		cl::Program prg(ctx, src);
+		try {
+			int ret = bench::build(prg, ctx, devices, bench::build_options(options));
+			if (ret != CL_SUCCESS) {
+				std::cout <<"BUILD FAIL" << std::endl;
+			}
+		} catch (cl::Error e) {
+			std::cerr << "Build failed:\n" << e.what() << " "
+				<< e.err() << std::endl;
+			std::cerr << "BUILD LOG:\n" <<
+				prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+				<< "\nLOG DONE\n";
+			return 1;
+		}
+
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		const size_t bytes = SUITE_SIZE * sizeof(float);
+		cl::Buffer in_x = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &x[0]);
+		cl::Buffer in_y = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &y[0]);
+		cl::Buffer in_n = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			SUITE_SIZE * sizeof(int), &n[0]);
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+		cl::Buffer spec_in_x = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			specials * sizeof(float), &spec_x[0]);
+		cl::Buffer spec_in_y = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			specials * sizeof(float), &spec_y[0]);
+		cl::Buffer spec_in_n = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			specials * sizeof(int), &spec_n[0]);
+		cl::Buffer spec_out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, specials * sizeof(float));
+
+		for (unsigned k = 0; k < SUITE; ++k) {
+			const std::string what = suite[k].name;
+			const func f = suite[k].f;
+			const bool square = suite[k].square;
+			cl::Kernel kernel(prg, suite[k].kernel);
+			kernel.setArg(0, in_x);
+			kernel.setArg(1, in_y);
+			kernel.setArg(2, in_n);
+			kernel.setArg(3, out);
+			kernel.setArg(4, (unsigned)SUITE_SIZE);
+			seconds[k] = bench::best_time(cmd, kernel,
+				cl::NDRange(SUITE_SIZE), cl::NullRange, SUITE_RUNS);
+			cmd.enqueueReadBuffer(out, true, 0, bytes, &results[0]);
+			/* x, the exponent operand if any, and the result */
+			bench::report(what, SUITE_SIZE, seconds[k],
+			              (square ? 2 : 3) * bytes);
+
+			double max_ulp = 0;
+			unsigned wrong = 0, reported = 0;
+			bench::parallel_for(SUITE_SIZE, [&](size_t begin, size_t end) {
+				double local_ulp = 0;
+				unsigned local_wrong = 0;
+				for (size_t i = begin; i < end; ++i) {
+					const double expected = square ?
+						reference(f, x[i], 2.0f, 2) :
+						reference(f, x[i], y[i], n[i]);
+					const double ulp =
+						bench::ulp_error(results[i], expected);
+					local_ulp = std::max(local_ulp, ulp);
+					if (ulp <= suite[k].max_ulp)
+						continue;
+					++local_wrong;
+					std::lock_guard<std::mutex> guard(bench::log_lock());
+					if (reported++ < MAX_REPORTED)
+						std::cerr << "Incorrect element(" << i
+							<< ") " << what << ": " << x[i]
+							<< " " << y[i] << " result: "
+							<< results[i] << " correct: "
+							<< expected << std::endl;
+				}
+				std::lock_guard<std::mutex> guard(bench::log_lock());
+				max_ulp = std::max(max_ulp, local_ulp);
+				wrong += local_wrong;
+			});
+
+			kernel.setArg(0, spec_in_x);
+			kernel.setArg(1, spec_in_y);
+			kernel.setArg(2, spec_in_n);
+			kernel.setArg(3, spec_out);
+			kernel.setArg(4, specials);
+			cmd.enqueueNDRangeKernel(kernel, cl::NullRange,
+				cl::NDRange(specials), cl::NullRange);
+			cmd.enqueueReadBuffer(spec_out, true, 0,
+				specials * sizeof(float), &spec_results[0]);
+			unsigned special_wrong = 0;
+			for (unsigned i = 0; i < specials; ++i) {
+				const double expected = square ?
+					reference(f, spec_x[i], 2.0f, 2) :
+					reference(f, spec_x[i], spec_y[i], spec_n[i]);
+				if (special_ok(spec_results[i], expected,
+				               std::isinf(suite[k].max_ulp) ?
+				               16 : suite[k].max_ulp))
+					continue;
+				if (special_wrong++ < MAX_REPORTED)
+					std::cerr << "Incorrect special " << what
+						<< ": " << spec_x[i] << " "
+						<< (f == POWN ? (float)spec_n[i] : spec_y[i])
+						<< " result: " << spec_results[i]
+						<< " correct: " << expected << std::endl;
+			}
+
+			std::cout << what << ": max ULP " << max_ulp
+				<< ", special cases " << specials - special_wrong
+				<< "/" << specials << std::endl;
+			rows[k].seconds = seconds[k];
+			rows[k].max_ulp = max_ulp;
+			rows[k].special_pass = specials - special_wrong;
+			rows[k].specials = specials;
+			/* native_powr has implementation defined accuracy */
+			if (std::isinf(suite[k].max_ulp))
+				continue;
+			if (wrong || special_wrong)
+				std::cout << "Wrong " << what << ": " << wrong
+					<< "/" << SUITE_SIZE << ", special "
+					<< special_wrong << "/" << specials
+					<< std::endl;
+			errors += wrong + special_wrong;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+
+	/* Lowering check: the literal exponent versions should be as fast
+	 * as the multiply, pow with integral exponents as fast as pown */
+	for (unsigned k = 0; k < SUITE; ++k)
+		std::cout << suite[k].name << ": " << seconds[k] / seconds[SUITE - 1]
+			<< "x the time of x * x" << std::endl;
+	std::cout << "pow(x, y)/pown(x, n) time ratio: "
+		<< seconds[0] / seconds[1] << std::endl;
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+/* The suite under every compile option set. Special cases are expected
+ * to break with the relaxed math options, so only the default set
+ * decides the exit code. */
+static int run_matrix(const cl::Context &ctx,
+                      const cl::vector<cl::Device> &devices)
+{
+	suite_row rows[bench::OPTION_SETS][SUITE];
+	int ret = 0;
+	for (unsigned o = 0; o < bench::OPTION_SETS; ++o) {
+		std::cout << "Options: " << bench::option_sets[o].name << std::endl;
+		/* rows stay empty if the build or a launch fails */
+		for (unsigned k = 0; k < SUITE; ++k)
+			rows[o][k] = suite_row{ 0, INFINITY, 0, 0 };
+		const int r = run_suite(ctx, devices,
+			bench::option_sets[o].options, rows[o]);
+		if (r && o == 0)
+			ret = r;
+	}
+
+	std::cout << "options, function, M/s, max ULP, special cases" << std::endl;
+	for (unsigned o = 0; o < bench::OPTION_SETS; ++o)
+	for (unsigned k = 0; k < SUITE; ++k) {
+		const suite_row &row = rows[o][k];
+		std::cout << bench::option_sets[o].name << ", " << suite[k].name
+			<< ", " << (row.seconds ? SUITE_SIZE / row.seconds / 1e6 : 0)
+			<< ", " << row.max_ulp << ", " << row.special_pass << "/"
+			<< row.specials << std::endl;
+	}
+	return ret;
+}
+
 int main(int argc, const char*argv[])
 {
-	(void) argc;
-	(void) argv;
+	bench::memory_reporter memory;
+	/* --suite runs the pow family comparison instead of the 64 element
+	 * check, --matrix runs it once per compile option set */
+	bool suite_mode = false, matrix = false;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--suite") {
+			suite_mode = true;
+		} else if (arg == "--matrix") {
+			matrix = true;
+		} else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
 
 	float data[DATA_SIZE];       // original data set given to device
 	float results[DATA_SIZE];    // results returned from device
 	float results2[DATA_SIZE];   // results returned from device
 
+	bench::perf::scope perf_input("input", DATA_SIZE);
         for(unsigned i = 0; i < DATA_SIZE; i++)
 	        data[i] = rand() / (float)RAND_MAX;
+	perf_input.end();
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -69,19 +399,31 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
+	/* the modes build and run their own programs */
+	if (matrix || suite_mode)
+		bench::trace::phase("run");
+	if (matrix)
+		return run_matrix(ctx, devices);
+	if (suite_mode) {
+		suite_row rows[SUITE];
+		return run_suite(ctx, devices, "", rows);
+	}
+
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer in(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
-	cl::Buffer out2(ctx, CL_MEM_WRITE_ONLY, sizeof(results2));
+	cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
+	cl::Buffer out2 = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results2));
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -97,6 +439,7 @@ int main(int argc, const char*argv[])
 	}
 
 
+	bench::trace::phase("run");
 	/* Create kernel and set arguments */
 	try {
 		cl::Kernel kernel(prg, "pow_test");
@@ -134,6 +477,7 @@ int main(int argc, const char*argv[])
 	}
 	unsigned errors1 = 0, errors2 = 0;
 #define ACC 0.00000001f
+	bench::perf::scope perf_verify("verify", DATA_SIZE);
 	for (int i = 0; i < DATA_SIZE; ++i) {
 		float result = data[i] * data[i];
 		if (abs(result - results[i]) >= ACC) {
@@ -151,6 +495,7 @@ int main(int argc, const char*argv[])
 		}
 #endif
 	}
+	perf_verify.end();
 
 	std::cout << "Wrong1: " << errors1 << "/" << DATA_SIZE << std::endl;
 #ifdef VECTOR
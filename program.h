@@ -0,0 +1,429 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+/* Kernel program loading and building.
+ * Tests that keep their kernels in .cl files get them mapped with mmap
+ * and specialized with -D options at build time, precompiled SPIR-V is
+ * used instead when the device takes IL.
+ * bench::build() builds any program from a binary compiled ahead of
+ * time (make kernels) when one matches the devices and driver, and
+ * reports per kernel resource usage (BENCH_REPORT, BENCH_BASELINE).
+ * Include after CL/cl.hpp and bench.h. */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bench {
+
+/* Read only mapping of a whole file, !ok() if it can't be mapped */
+class mapped_file {
+public:
+	explicit mapped_file(const ::std::string &path)
+		: addr(MAP_FAILED), len(0)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			len = st.st_size;
+			addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+	}
+	~mapped_file()
+	{
+		if (addr != MAP_FAILED)
+			munmap(addr, len);
+	}
+	bool ok() const { return addr != MAP_FAILED; }
+	const char *data() const { return (const char *)addr; }
+	size_t size() const { return len; }
+private:
+	mapped_file(const mapped_file &);
+	mapped_file &operator=(const mapped_file &);
+	void *addr;
+	size_t len;
+};
+
+/* Directory of the running test, kernel files live next to it */
+static inline ::std::string exe_dir(const char *argv0)
+{
+	const ::std::string path(argv0);
+	const size_t slash = path.rfind('/');
+	return slash == ::std::string::npos ? "." : path.substr(0, slash);
+}
+
+/* Path of the running test, binaries are stored next to it */
+static inline ::std::string exe_path()
+{
+	char buf[4096];
+	const ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+	return len > 0 ? ::std::string(buf, len) : "./test";
+}
+
+static inline uint32_t fnv1a(const ::std::string &s)
+{
+	uint32_t hash = 2166136261u;
+	for (unsigned char c:s)
+		hash = (hash ^ c) * 16777619u;
+	return hash;
+}
+
+static inline uint64_t fnv1a64(const ::std::string &s,
+                               uint64_t hash = 14695981039346656037ULL)
+{
+	for (unsigned char c:s)
+		hash = (hash ^ c) * 1099511628211ULL;
+	return hash;
+}
+
+/* SPIR-V can't be specialized at build time, every set of defines has
+ * its own file: stem.spv, or stem-<fnv1a of defines>.spv. The tests
+ * print their names with --il-names for make spirv. */
+static inline ::std::string il_path(const ::std::string &stem,
+                                    const ::std::string &defines)
+{
+	if (defines.empty())
+		return stem + ".spv";
+	char hash[9];
+	snprintf(hash, sizeof(hash), "%08x", fnv1a(defines));
+	return stem + "-" + hash + ".spv";
+}
+
+static inline bool device_has_il(const cl::Device &dev)
+{
+#ifdef CL_VERSION_2_1
+	size_t size = 0;
+	return clGetDeviceInfo(dev(), CL_DEVICE_IL_VERSION, 0, NULL, &size)
+		== CL_SUCCESS && size > 1;
+#else
+	(void)dev;
+	return false;
+#endif
+}
+
+enum program_kind { PROGRAM_SOURCE, PROGRAM_IL, PROGRAM_KINDS };
+
+static const char *program_kind_names[PROGRAM_KINDS] = { "source", "il" };
+
+/* How a program was created and how long creating and building took */
+struct program_setup {
+	program_kind kind;
+	double create;
+	double build;
+};
+
+/* Creates (but does not build) the program for stem, the kernel path
+ * without extension. Uses the SPIR-V for defines if it exists, the
+ * device takes IL and BENCH_NO_IL is not set, otherwise the mmapped
+ * stem.cl source. Throws cl::Error if neither can be loaded. */
+static inline cl::Program create_program(const cl::Context &ctx,
+                                         const cl::Device &dev,
+                                         const ::std::string &stem,
+                                         const ::std::string &defines,
+                                         program_setup &setup)
+{
+	const double start = now();
+#ifdef CL_VERSION_2_1
+	if (!getenv("BENCH_NO_IL") && device_has_il(dev)) {
+		const mapped_file il(il_path(stem, defines));
+		if (il.ok()) {
+			cl_int err = CL_SUCCESS;
+			cl_program prg = clCreateProgramWithIL(ctx(), il.data(),
+			                                       il.size(), &err);
+			if (err == CL_SUCCESS) {
+				setup.kind = PROGRAM_IL;
+				setup.create = now() - start;
+				return cl::Program(prg);
+			}
+		}
+	}
+#else
+	(void)dev;
+	(void)defines;
+#endif
+	const ::std::string path = stem + ".cl";
+	const mapped_file src(path);
+	if (!src.ok()) {
+		::std::cerr << "Cannot map kernel source " << path << ::std::endl;
+		throw cl::Error(CL_INVALID_VALUE, "create_program");
+	}
+	cl::Program::Sources sources(1,
+		::std::make_pair(src.data(), src.size()));
+	cl::Program prg(ctx, sources);
+	setup.kind = PROGRAM_SOURCE;
+	setup.create = now() - start;
+	return prg;
+}
+
+/* Binary for source and options on exactly these devices and drivers,
+ * any change picks a different file */
+template<typename Devices>
+static inline ::std::string binary_path(const Devices &devices,
+                                        const ::std::string &source,
+                                        const ::std::string &options)
+{
+	uint64_t hash = fnv1a64(source);
+	hash = fnv1a64(options, hash);
+	for (unsigned d = 0; d < devices.size(); ++d) {
+		hash = fnv1a64(devices[d].template getInfo<CL_DEVICE_NAME>(), hash);
+		hash = fnv1a64(devices[d].template getInfo<CL_DRIVER_VERSION>(), hash);
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "-%016llx.bin", (unsigned long long)hash);
+	return exe_path() + name;
+}
+
+/* Binary files hold a 64-bit size and the binary for every device.
+ * Returns false if there is no usable file or the driver rejects it. */
+template<typename Devices>
+static inline bool load_binary(const cl::Context &ctx, const Devices &devices,
+                               const ::std::string &path,
+                               const ::std::string &options, cl::Program &prg)
+{
+	const mapped_file file(path);
+	if (!file.ok())
+		return false;
+	cl::Program::Binaries binaries;
+	const char *p = file.data(), *end = p + file.size();
+	for (unsigned d = 0; d < devices.size(); ++d) {
+		uint64_t size;
+		if ((size_t)(end - p) < sizeof(size))
+			return false;
+		memcpy(&size, p, sizeof(size));
+		p += sizeof(size);
+		if ((uint64_t)(end - p) < size)
+			return false;
+		binaries.push_back(::std::make_pair((const void *)p, (size_t)size));
+		p += size;
+	}
+	try {
+		cl::Program binary(ctx, devices, binaries);
+		binary.build(devices, options.c_str());
+		prg = binary;
+		return true;
+	} catch (cl::Error e) {
+		::std::cerr << "Binary " << path << " rejected: " << e.err()
+			<< ", building from source" << ::std::endl;
+		return false;
+	}
+}
+
+/* Written to a temporary and renamed, a concurrent run never maps half
+ * a binary */
+static inline void save_binary(const cl::Program &prg, size_t devices,
+                               const ::std::string &path)
+{
+	::std::vector<size_t> sizes(devices);
+	if (clGetProgramInfo(prg(), CL_PROGRAM_BINARY_SIZES,
+	                     devices * sizeof(size_t), &sizes[0], NULL) != CL_SUCCESS)
+		return;
+	::std::vector< ::std::vector<unsigned char> > blobs(devices);
+	::std::vector<unsigned char *> ptrs(devices);
+	for (size_t d = 0; d < devices; ++d) {
+		blobs[d].resize(sizes[d]);
+		ptrs[d] = blobs[d].empty() ? NULL : &blobs[d][0];
+	}
+	if (clGetProgramInfo(prg(), CL_PROGRAM_BINARIES,
+	                     devices * sizeof(unsigned char *), &ptrs[0], NULL) != CL_SUCCESS)
+		return;
+	const ::std::string tmp = path + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "wb");
+	if (!f)
+		return;
+	bool ok = true;
+	for (size_t d = 0; d < devices; ++d) {
+		const uint64_t size = sizes[d];
+		ok = ok && fwrite(&size, sizeof(size), 1, f) == 1;
+		ok = ok && (!size || fwrite(ptrs[d], size, 1, f) == 1);
+	}
+	ok = (fclose(f) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+		unlink(tmp.c_str());
+}
+
+/* Resource report, one tab separated line per kernel and device:
+ * test device options kernel private_mem local_mem work_group_size
+ * preferred_multiple binary_size build_ms built_from
+ * binary_size is the size of the whole program binary for the device,
+ * built_from is source, binary (make kernels) or il. */
+enum {
+	REPORT_KEY_FIELDS = 4,
+	REPORT_BUILD_MS = 9,
+	REPORT_BUILT_FROM = 10,
+	REPORT_FIELDS = 11,
+};
+
+static inline ::std::vector< ::std::string> split_tabs(const ::std::string &line)
+{
+	::std::vector< ::std::string> fields;
+	::std::istringstream in(line);
+	::std::string field;
+	while (::std::getline(in, field, '\t'))
+		fields.push_back(field);
+	return fields;
+}
+
+/* BENCH_BASELINE report keyed by its first REPORT_KEY_FIELDS fields,
+ * read once */
+static inline const ::std::map< ::std::string, ::std::vector< ::std::string> > &
+baseline()
+{
+	static ::std::map< ::std::string, ::std::vector< ::std::string> > rows;
+	static bool loaded = false;
+	if (loaded)
+		return rows;
+	loaded = true;
+	const char *path = getenv("BENCH_BASELINE");
+	if (!path)
+		return rows;
+	::std::ifstream in(path);
+	::std::string line;
+	while (::std::getline(in, line)) {
+		const ::std::vector< ::std::string> fields = split_tabs(line);
+		if (fields.size() != REPORT_FIELDS || fields[0] == "test")
+			continue;
+		::std::string key;
+		for (unsigned f = 0; f < REPORT_KEY_FIELDS; ++f)
+			key += fields[f] + "\t";
+		rows[key] = fields;
+	}
+	return rows;
+}
+
+/* Prints every value that got worse than in the baseline: more private
+ * (spills) or local memory, smaller work-groups, a different preferred
+ * multiple, over 5% more code or twice the build time. Build times are
+ * only compared between programs built the same way, loading a binary
+ * is no compiler speedup. */
+static inline void compare_baseline(const ::std::vector< ::std::string> &row)
+{
+	::std::string key;
+	for (unsigned f = 0; f < REPORT_KEY_FIELDS; ++f)
+		key += row[f] + "\t";
+	const auto it = baseline().find(key);
+	if (it == baseline().end())
+		return;
+	static const char *names[REPORT_FIELDS] = { "test", "device", "options",
+		"kernel", "private_mem", "local_mem", "work_group_size",
+		"preferred_multiple", "binary_size", "build_ms", "built_from" };
+	for (unsigned f = REPORT_KEY_FIELDS; f < REPORT_BUILT_FROM; ++f) {
+		if (f == REPORT_BUILD_MS &&
+		    row[REPORT_BUILT_FROM] != it->second[REPORT_BUILT_FROM])
+			continue;
+		const double was = atof(it->second[f].c_str());
+		const double is = atof(row[f].c_str());
+		bool worse;
+		switch (f) {
+		case 6: worse = is < was; break;
+		case 7: worse = is != was; break;
+		case 8: worse = is > was * 1.05; break;
+		case REPORT_BUILD_MS: worse = is > was * 2; break;
+		default: worse = is > was; break;
+		}
+		if (worse)
+			::std::cout << "Resource regression " << row[0] << " "
+				<< row[3] << " [" << row[2] << "]: " << names[f]
+				<< " " << it->second[f] << " -> " << row[f]
+				<< ::std::endl;
+	}
+}
+
+/* Queries the resources of every kernel in a built program and appends
+ * them to BENCH_REPORT and/or compares them with BENCH_BASELINE */
+template<typename Devices>
+static inline void report_resources(const cl::Program &prg,
+                                    const Devices &devices,
+                                    const ::std::string &options,
+                                    double build_seconds,
+                                    const char *built_from)
+{
+	const char *report = getenv("BENCH_REPORT");
+	if (!report && !getenv("BENCH_BASELINE"))
+		return;
+	const ::std::string dir = exe_dir(exe_path().c_str());
+	const ::std::string test = dir.substr(dir.rfind('/') + 1);
+	::std::vector<size_t> sizes(devices.size());
+	clGetProgramInfo(prg(), CL_PROGRAM_BINARY_SIZES,
+	                 sizes.size() * sizeof(size_t), &sizes[0], NULL);
+
+	::std::ofstream out;
+	if (report) {
+		const bool fresh = !mapped_file(report).ok();
+		out.open(report, ::std::ios::app);
+		if (fresh)
+			out << "test\tdevice\toptions\tkernel\tprivate_mem\t"
+				"local_mem\twork_group_size\tpreferred_multiple\t"
+				"binary_size\tbuild_ms\tbuilt_from\n";
+	}
+	::std::istringstream names(prg.getInfo<CL_PROGRAM_KERNEL_NAMES>());
+	::std::string name;
+	while (::std::getline(names, name, ';')) {
+		const cl::Kernel kernel(prg, name.c_str());
+		for (unsigned d = 0; d < devices.size(); ++d) {
+			const cl::Device &dev = devices[d];
+			const ::std::vector< ::std::string> row = {
+				test,
+				dev.template getInfo<CL_DEVICE_NAME>(),
+				options,
+				name,
+				::std::to_string(kernel.getWorkGroupInfo<CL_KERNEL_PRIVATE_MEM_SIZE>(dev)),
+				::std::to_string(kernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(dev)),
+				::std::to_string(kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(dev)),
+				::std::to_string(kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(dev)),
+				::std::to_string(sizes[d]),
+				::std::to_string(build_seconds * 1e3),
+				built_from,
+			};
+			if (report)
+				for (unsigned f = 0; f < REPORT_FIELDS; ++f)
+					out << row[f] << (f + 1 < REPORT_FIELDS ? '\t' : '\n');
+			compare_baseline(row);
+		}
+	}
+}
+
+/* Drop-in for prg.build(devices, options). If a binary saved for this
+ * source, options, devices and driver exists it is built instead and
+ * replaces prg, a missing or rejected binary falls back to the source.
+ * With BENCH_SAVE_BINARIES set source builds are saved for the next run.
+ * IL programs have no source and are always built directly. Throws
+ * cl::Error like build(), prg is then the failed source program. */
+template<typename Devices>
+static inline cl_int build(cl::Program &prg, const cl::Context &ctx,
+                           const Devices &devices, const ::std::string &options)
+{
+	trace::scope span("build program");
+	const double start = now();
+	const ::std::string source = prg.getInfo<CL_PROGRAM_SOURCE>();
+	cl_int ret = CL_SUCCESS;
+	const char *built_from = "il";
+	if (source.empty()) {
+		ret = prg.build(devices, options.c_str());
+	} else {
+		const ::std::string path = binary_path(devices, source, options);
+		built_from = "binary";
+		if (!load_binary(ctx, devices, path, options, prg)) {
+			built_from = "source";
+			ret = prg.build(devices, options.c_str());
+			if (ret == CL_SUCCESS && getenv("BENCH_SAVE_BINARIES"))
+				save_binary(prg, devices.size(), path);
+		}
+	}
+	if (ret == CL_SUCCESS)
+		report_resources(prg, devices, options, now() - start,
+		                 built_from);
+	return ret;
+}
+
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef REPRO_H
+#define REPRO_H
+
+/* Failure repro files. A test adds one record per failing element (its
+ * index, inputs and device outputs, the layout is up to the test) and
+ * saves them to BENCH_REPRO or <test>.repro when anything failed. The
+ * test's --replay=<file> mode loads the records again and re-runs only
+ * those elements. Include after program.h. */
+
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace bench {
+
+enum {
+	REPRO_VERSION = 1,
+	REPRO_MAX_RECORDS = 1 << 20,
+};
+
+struct repro_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t count;
+	char test[32];
+};
+
+static const char repro_magic[8] = { 'B', 'E', 'N', 'C', 'H', 'R', 'P', 'R' };
+
+/* Collects records of type R from any thread */
+template<typename R>
+class repro_writer {
+public:
+	explicit repro_writer(const char *test) : test(test), dropped(0) {}
+
+	void add(const R &record)
+	{
+		::std::lock_guard< ::std::mutex> guard(lock);
+		if (records.size() < REPRO_MAX_RECORDS)
+			records.push_back(record);
+		else
+			++dropped;
+	}
+
+	/* Writes the records if there are any, otherwise removes the repro
+	 * of an earlier failing run. Returns false on I/O errors. */
+	bool save() const
+	{
+		const char *env = getenv("BENCH_REPRO");
+		const ::std::string path = env ? env : ::std::string(test) + ".repro";
+		if (records.empty()) {
+			if (unlink(path.c_str()) && errno != ENOENT) {
+				perror(path.c_str());
+				return false;
+			}
+			return true;
+		}
+		repro_header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, repro_magic, sizeof(h.magic));
+		h.version = REPRO_VERSION;
+		h.record_size = sizeof(R);
+		h.count = records.size();
+		strncpy(h.test, test, sizeof(h.test) - 1);
+		FILE *f = fopen(path.c_str(), "wb");
+		if (!f) {
+			perror(path.c_str());
+			return false;
+		}
+		bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+		ok = ok && fwrite(&records[0], sizeof(R), records.size(), f) ==
+			records.size();
+		ok = (fclose(f) == 0) && ok;
+		if (!ok) {
+			::std::cerr << "Failed to write " << path << ::std::endl;
+			return false;
+		}
+		::std::cout << "Repro: " << records.size() << " elements in "
+			<< path;
+		if (dropped)
+			::std::cout << " (" << dropped << " more not saved)";
+		::std::cout << ", rerun with --replay=" << path << ::std::endl;
+		return true;
+	}
+private:
+	repro_writer(const repro_writer &);
+	repro_writer &operator=(const repro_writer &);
+
+	const char *test;
+	::std::mutex lock;
+	::std::vector<R> records;
+	size_t dropped;
+};
+
+/* Reads the records of test from path, false (with a message) if it is
+ * not a repro file of this test and record layout */
+template<typename R>
+static inline bool load_repro(const ::std::string &path, const char *test,
+                              ::std::vector<R> &records)
+{
+	mapped_file file(path);
+	if (!file.ok() || file.size() < sizeof(repro_header)) {
+		::std::cerr << "Can't read repro file " << path << ::std::endl;
+		return false;
+	}
+	repro_header h;
+	memcpy(&h, file.data(), sizeof(h));
+	if (memcmp(h.magic, repro_magic, sizeof(h.magic)) ||
+	    h.version != REPRO_VERSION || h.record_size != sizeof(R) ||
+	    strncmp(h.test, test, sizeof(h.test)) ||
+	    file.size() != sizeof(h) + h.count * sizeof(R)) {
+		::std::cerr << path << " is not a " << test
+			<< " repro file of this version" << ::std::endl;
+		return false;
+	}
+	records.resize(h.count);
+	if (h.count)
+		memcpy(&records[0], file.data() + sizeof(h), h.count * sizeof(R));
+	return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+/* Shift and rotate engine, replaces the old shl, sra and srl tests.
+ * Built per type pair, vector width and constant amount:
+ * -DSTYPE=long -DUTYPE=ulong -DWIDTH=<n> -DAMOUNT=<k>
+ * Every op comes in three flavours: compile time constant amount,
+ * uniform runtime amount (kernel argument) and per lane amounts read
+ * from a buffer. Amounts >= bit width are legal in OpenCL C and have to
+ * be masked by the implementation. */
+#define CAT_(a, b) a##b
+#define CAT(a, b) CAT_(a, b)
+#if WIDTH == 1
+#define VEC(t) t
+#define LOAD(i, p) (p)[i]
+#define STORE(v, i, p) (p)[i] = (v)
+#else
+#define VEC(t) CAT(t, WIDTH)
+#define LOAD(i, p) CAT(vload, WIDTH)(i, p)
+#define STORE(v, i, p) CAT(vstore, WIDTH)(v, i, p)
+#endif
+#define TEST(name, type, expr) \
+__kernel void name( \
+   __global const type* input, \
+   __global const UTYPE* amounts, \
+   UTYPE n, \
+   __global type* output) \
+{ \
+   size_t i = get_global_id(0); \
+   STORE(expr, i, output); \
+}
+#define X LOAD(i, input)
+#define V LOAD(i, amounts)
+#define UN ((VEC(UTYPE))(n))
+#define SN ((VEC(STYPE))(n))
+TEST(shl_const, UTYPE, X << AMOUNT)
+TEST(shl_uniform, UTYPE, X << UN)
+TEST(shl_variable, UTYPE, X << V)
+TEST(sra_const, STYPE, X >> AMOUNT)
+TEST(sra_uniform, STYPE, X >> SN)
+TEST(sra_variable, STYPE, X >> CAT(as_, VEC(STYPE))(V))
+TEST(srl_const, UTYPE, X >> AMOUNT)
+TEST(srl_uniform, UTYPE, X >> UN)
+TEST(srl_variable, UTYPE, X >> V)
+TEST(rotate_const, UTYPE, rotate(X, (VEC(UTYPE))(AMOUNT)))
+TEST(rotate_uniform, UTYPE, rotate(X, UN))
+TEST(rotate_variable, UTYPE, rotate(X, V))
@@ -0,0 +1,324 @@
+#include <iostream>
+#include <climits>
+#include <string>
+#include <vector>
+
+
+#define __NO_STD_VECTOR // Use cl::vector instead of STL version
+#define __CL_ENABLE_EXCEPTIONS
+#include <CL/cl.hpp>
+
+#include "bench.h"
+#include "program.h"
+
+/* Kernels are in shift.cl next to the binary, see the comment there */
+
+enum {
+	DATA_SIZE = 8 * 1024 * 1024,
+	MAX_REPORTED = 16,
+};
+
+enum op { SHL, SRA, SRL, ROTATE, OPS };
+enum variant { CONST, UNIFORM, VARIABLE, VARIANTS };
+
+static const char *op_names[OPS] = { "shl", "sra", "srl", "rotate" };
+static const char *variant_names[VARIANTS] = { "const", "uniform", "variable" };
+
+static const unsigned widths[] = { 1, 2, 4, 8, 16 };
+enum { WIDTHS = sizeof(widths) / sizeof(widths[0]) };
+
+/* Reference with the OpenCL masking rule applied explicitly */
+template<typename U, typename S>
+static U reference(unsigned op, U x, U n)
+{
+	const unsigned bits = sizeof(U) * CHAR_BIT;
+	n &= bits - 1;
+	switch (op) {
+	case SHL: return x << n;
+	case SRA: return (U)((S)x >> n);
+	case SRL: return x >> n;
+	default: return n ? (U)(x << n | x >> (bits - n)) : x;
+	}
+}
+
+/* Checks results against the reference, with per lane amounts or, if
+ * amounts is NULL, the same amount for every lane */
+template<typename U, typename S>
+static unsigned verify(unsigned op, const U *data, const U *amounts,
+                       U amount, const U *results, size_t count,
+                       const ::std::string &what)
+{
+	unsigned errors = 0, reported = 0;
+	bench::perf::scope perf("verify", count);
+	bench::parallel_for(count, [&](size_t begin, size_t end) {
+		unsigned local_errors = 0;
+		for (size_t i = begin; i < end; ++i) {
+			const U n = amounts ? amounts[i] : amount;
+			const U result = reference<U, S>(op, data[i], n);
+			if (result == results[i])
+				continue;
+			++local_errors;
+			::std::lock_guard< ::std::mutex> guard(bench::log_lock());
+			if (reported++ >= MAX_REPORTED)
+				continue;
+			::std::cerr << "Incorrect element(" << ::std::dec
+				<< i << ") " << what << ": " << ::std::hex
+				<< (unsigned long long)data[i] << " by "
+				<< ::std::dec << (unsigned long long)n
+				<< " result: " << ::std::hex
+				<< (unsigned long long)results[i] << " correct: "
+				<< (unsigned long long)result << ::std::dec
+				<< ::std::endl;
+		}
+		::std::lock_guard< ::std::mutex> guard(bench::log_lock());
+		errors += local_errors;
+	});
+	return errors;
+}
+
+/* Constant amounts for a bits wide type, the last one checks masking */
+enum { AMOUNTS = 4 };
+
+static void const_amounts(unsigned bits, unsigned amounts[AMOUNTS])
+{
+	amounts[0] = 1;
+	amounts[1] = bits / 2;
+	amounts[2] = bits - 1;
+	amounts[3] = bits + 3;
+}
+
+/* -D options of one specialization of shift.cl */
+static ::std::string program_defines(const ::std::string &stype,
+                                     const ::std::string &utype,
+                                     unsigned width, unsigned amount)
+{
+	return "-DSTYPE=" + stype + " -DUTYPE=" + utype + " -DWIDTH=" +
+		::std::to_string(width) + " -DAMOUNT=" + ::std::to_string(amount);
+}
+
+/* The 64-bit pair and its 32-bit baseline, in run order */
+static const struct {
+	const char *utype, *stype;
+	unsigned bits;
+} type_pairs[] = { { "ulong", "long", 64 }, { "uint", "int", 32 } };
+
+/* SPIR-V file and defines of every program, one per line, for make spirv */
+static void print_il_names(const ::std::string &stem)
+{
+	for (const auto &pair : type_pairs)
+	for (unsigned w = 0; w < WIDTHS; ++w) {
+		unsigned amounts[AMOUNTS];
+		const_amounts(pair.bits, amounts);
+		for (unsigned a = 0; a < AMOUNTS; ++a) {
+			const ::std::string def = program_defines(pair.stype,
+				pair.utype, widths[w], amounts[a]);
+			::std::cout << bench::il_path(stem, def) << " " << def
+				<< ::std::endl;
+		}
+	}
+}
+
+/* Program setup time summed over all specializations, per kind */
+struct setup_total {
+	unsigned programs;
+	double create;
+	double build;
+};
+
+/* Runs every op/variant over up to DATA_SIZE elements of U (and its
+ * signed counterpart S for sra), as many as fit the device, with the
+ * programs built from stem. Returns the number of wrong elements, or -1
+ * if the device failed. */
+template<typename U, typename S>
+static long run_type(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const cl::CommandQueue &cmd,
+                     const ::std::string &stem, setup_total *totals,
+                     const ::std::string &utype, const ::std::string &stype)
+{
+	const unsigned bits = sizeof(U) * CHAR_BIT;
+	unsigned amounts_const[AMOUNTS];
+	const_amounts(bits, amounts_const);
+	/* data, amounts and results on both sides, whole vectors only */
+	const size_t count = bench::fit_elements(devices[0], DATA_SIZE,
+		3 * sizeof(U), sizeof(U), 3 * sizeof(U), widths[WIDTHS - 1]);
+	if (count < DATA_SIZE)
+		::std::cout << "Device memory fits " << count << " " << utype
+			<< " elements" << ::std::endl;
+
+	::std::vector<U> data(count), amounts(count), results(count);
+	uint64_t seed = 0x5851F42D4C957F2DULL + bits;
+	for (size_t i = 0; i < count; ++i) {
+		data[i] = (U)bench::rand64(seed);
+		/* per lane amounts, half of them >= bit width */
+		amounts[i] = (U)(bench::rand64(seed) % (2 * bits));
+	}
+
+	const size_t bytes = count * sizeof(U);
+	cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &data[0]);
+	cl::Buffer amt = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &amounts[0]);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+
+	long errors = 0;
+	for (unsigned w = 0; w < WIDTHS; ++w)
+	for (unsigned a = 0; a < AMOUNTS; ++a) {
+		const unsigned width = widths[w];
+		const unsigned amount = amounts_const[a];
+		const ::std::string type = utype +
+			(width == 1 ? "" : ::std::to_string(width));
+
+		const ::std::string def = program_defines(stype, utype, width,
+		                                          amount);
+		bench::program_setup setup;
+		cl::Program prg = bench::create_program(ctx, devices[0], stem,
+		                                        def, setup);
+		try {
+			const double start = bench::now();
+			int ret = bench::build(prg, ctx, devices, bench::build_options(def));
+			if (ret != CL_SUCCESS) {
+				::std::cout <<"BUILD FAIL" << ::std::endl;
+			}
+			setup.build = bench::now() - start;
+			setup_total &total = totals[setup.kind];
+			++total.programs;
+			total.create += setup.create;
+			total.build += setup.build;
+		} catch (cl::Error e) {
+			::std::cerr << "Build failed:\n" << e.what() << " "
+				<< e.err() << ::std::endl;
+			::std::cerr << "BUILD LOG:\n" <<
+				prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+				<< "\nLOG DONE\n";
+			return -1;
+		}
+
+		for (unsigned op = 0; op < OPS; ++op)
+		for (unsigned v = 0; v < VARIANTS; ++v) {
+			/* per lane amounts do not depend on AMOUNT */
+			if (v == VARIABLE && a != 0)
+				continue;
+			const ::std::string kname =
+				::std::string(op_names[op]) + "_" + variant_names[v];
+			cl::Event ev;
+			try {
+				cl::Kernel kernel(prg, kname.c_str());
+				kernel.setArg(0, in);
+				kernel.setArg(1, amt);
+				kernel.setArg(2, (U)amount);
+				kernel.setArg(3, out);
+
+				cmd.enqueueNDRangeKernel(kernel, cl::NDRange(0),
+					cl::NDRange(count / width),
+					cl::NullRange, NULL, &ev);
+				cmd.finish();
+				cmd.enqueueReadBuffer(out, true, 0, bytes,
+					&results[0], 0);
+			} catch (cl::Error e) {
+				::std::cerr << "Kernel failed: " << e.what() << " "
+					<< e.err() << ::std::endl;
+				return -1;
+			}
+			const ::std::string what = type + " " + kname +
+				(v == VARIABLE ? "" : "(" + ::std::to_string(amount) + ")");
+			/* variable reads the amounts buffer as well */
+			bench::report(what, count, bench::event_seconds(ev),
+			              (v == VARIABLE ? 3 : 2) * bytes);
+			const unsigned wrong = verify<U, S>(op, &data[0],
+				v == VARIABLE ? &amounts[0] : NULL, (U)amount,
+				&results[0], count, what);
+			if (wrong)
+				::std::cout << "Wrong " << what << ": " << wrong
+					<< "/" << count << ::std::endl;
+			errors += wrong;
+		}
+	}
+	return errors;
+}
+
+int main(int argc, const char*argv[])
+{
+	bench::memory_reporter memory;
+	/* Programs come from shift.cl or its SPIR-V next to the binary */
+	const std::string stem = bench::exe_dir(argv[0]) + "/shift";
+	/* --il-names lists the SPIR-V files the IL path looks for */
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--il-names") {
+			print_il_names(stem);
+			return 0;
+		}
+		std::cerr << "Unknown argument: " << arg << std::endl;
+		return 1;
+	}
+
+	bench::trace::phase("platform");
+	cl::vector< cl::Platform > platformList;
+	cl::Platform::get(&platformList);
+	std::cout << "Platform count is: " << platformList.size() << std::endl;
+	if (platformList.size() < 1)
+		return 1;
+
+	cl::Platform platform = platformList[0];
+
+	std::string vendor, name, version;
+	platform.getInfo(CL_PLATFORM_VENDOR, &vendor);
+	platform.getInfo(CL_PLATFORM_NAME, &name);
+	platform.getInfo(CL_PLATFORM_VERSION, &version);
+	std::cout << "Platform is `" << name << "' by: " << vendor
+		<< " version: " << version << std::endl;
+
+	cl::vector <cl::Device> devices;
+	platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+	std::cout << devices.size() << " available device(s)\n";
+	if (devices.size() == 0)
+		return 1;
+
+	devices[0].getInfo(CL_DEVICE_VENDOR, &vendor);
+	devices[0].getInfo(CL_DEVICE_NAME, &name);
+	devices[0].getInfo(CL_DEVICE_VERSION, &version);
+	std::cout << "Platform is `" << name << "' by: " << vendor
+		<< " version: " << version << std::endl;
+
+	bench::trace::phase("context");
+	/* Create CL context */
+	cl::Context ctx(devices);
+
+	setup_total totals[bench::PROGRAM_KINDS] = {};
+
+	long errors64, errors32;
+	try {
+		bench::trace::phase("run");
+		/* Command queue */
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+
+		errors64 = run_type<cl_ulong, cl_long>(ctx, devices, cmd, stem,
+			totals, type_pairs[0].utype, type_pairs[0].stype);
+		/* 32-bit baseline for the 64-bit numbers */
+		errors32 = run_type<cl_uint, cl_int>(ctx, devices, cmd, stem,
+			totals, type_pairs[1].utype, type_pairs[1].stype);
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	} catch (...) {
+		return 1;
+	}
+	if (errors64 < 0 || errors32 < 0)
+		return 1;
+
+	/* Startup cost, source front end vs SPIR-V */
+	for (unsigned k = 0; k < bench::PROGRAM_KINDS; ++k) {
+		if (!totals[k].programs)
+			continue;
+		std::cout << "Program setup ("
+			<< bench::program_kind_names[k] << "): "
+			<< totals[k].programs << " programs, create "
+			<< totals[k].create * 1e3 << " ms, build "
+			<< totals[k].build * 1e3 << " ms, "
+			<< (totals[k].create + totals[k].build) * 1e3 /
+			   totals[k].programs << " ms per program" << std::endl;
+	}
+
+	std::cout << "Wrong: " << errors64 + errors32 << std::endl;
+	return 0;
+}
@@ -1,10 +1,16 @@
+#include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+
 // Simple compute kernel which computes the square of an input array
 
 const char kernelSource[] = "             \n" \
@@ -19,18 +25,293 @@ const char kernelSource[] = "             \n" \
 "}                                       \n" \
 "\n";
 
+/* Fused cross-check of formulations equivalent to x * x. Every element
+ * is loaded once, disagreements are counted in local memory and merged
+ * into the global counters once per work-group:
+ * counters[0 .. CHECKS) results that differ from x * x at all
+ * counters[CHECKS .. 2 * CHECKS) results more than tolerance ULPs off
+ * counters[2 * CHECKS .. 3 * CHECKS) max ULP distance
+ * counters[3 * CHECKS .. 4 * CHECKS) first index over tolerance
+ * square_sep and pow_sep are the two old tests for comparison. */
+const char checkSource[] = "                                  \n" \
+"#define CHECKS 5                                              \n" \
+"__constant uint tolerance[CHECKS] = { 16, 16, 16, 0, 0 };     \n" \
+"__kernel void crosscheck(                                     \n" \
+"   __global const float *input,                               \n" \
+"   unsigned count,                                            \n" \
+"   unsigned base,                                             \n" \
+"   __global uint *counters)                                   \n" \
+"{                                                             \n" \
+"   __local uint differ[CHECKS], wrong[CHECKS];                \n" \
+"   __local uint max_ulps[CHECKS], first[CHECKS];              \n" \
+"   uint lid = get_local_id(0);                                \n" \
+"   if (lid < CHECKS) {                                        \n" \
+"      differ[lid] = wrong[lid] = max_ulps[lid] = 0;           \n" \
+"      first[lid] = ~0u;                                       \n" \
+"   }                                                          \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                              \n" \
+"   for (uint i = get_global_id(0); i < count;                 \n" \
+"        i += get_global_size(0)) {                            \n" \
+"      float x = input[i];                                     \n" \
+"      float ref = x * x;                                      \n" \
+"      float v[CHECKS] = {                                     \n" \
+"         pow(x, 2.0f),                                        \n" \
+"         pown(x, 2),                                          \n" \
+"         powr(fabs(x), 2.0f),                                 \n" \
+"         fma(x, x, 0.0f),                                     \n" \
+"         (x + x) * x * 0.5f,                                  \n" \
+"      };                                                      \n" \
+"      for (uint c = 0; c < CHECKS; ++c) {                     \n" \
+"         if (as_uint(v[c]) == as_uint(ref))                   \n" \
+"            continue;                                         \n" \
+"         uint ulps = abs(as_int(v[c]) - as_int(ref));         \n" \
+"         atomic_inc(&differ[c]);                              \n" \
+"         atomic_max(&max_ulps[c], ulps);                      \n" \
+"         if (ulps > tolerance[c]) {                           \n" \
+"            atomic_inc(&wrong[c]);                            \n" \
+"            atomic_min(&first[c], base + i);                  \n" \
+"         }                                                    \n" \
+"      }                                                       \n" \
+"   }                                                          \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                              \n" \
+"   if (lid < CHECKS && differ[lid]) {                         \n" \
+"      atomic_add(&counters[lid], differ[lid]);                \n" \
+"      atomic_add(&counters[CHECKS + lid], wrong[lid]);        \n" \
+"      atomic_max(&counters[2 * CHECKS + lid], max_ulps[lid]); \n" \
+"      atomic_min(&counters[3 * CHECKS + lid], first[lid]);    \n" \
+"   }                                                          \n" \
+"}                                                             \n" \
+"__kernel void square_sep(                                     \n" \
+"   __global const float *input,                               \n" \
+"   __global float *output)                                    \n" \
+"{                                                             \n" \
+"   size_t i = get_global_id(0);                               \n" \
+"   output[i] = input[i] * input[i];                           \n" \
+"}                                                             \n" \
+"__kernel void pow_sep(                                        \n" \
+"   __global const float *input,                               \n" \
+"   __global float *output)                                    \n" \
+"{                                                             \n" \
+"   size_t i = get_global_id(0);                               \n" \
+"   output[i] = pow(input[i], 2.0f);                           \n" \
+"}                                                             \n" \
+"\n";
+
 enum {
 	DATA_SIZE = 64,
+	/* cross-check mode */
+	CHECKS = 5,
+	CHECK_CHUNK = 16 * 1024 * 1024,
+	CHECK_LOCAL_SIZE = 256,
+	CHECK_GROUPS_PER_CU = 8,
+	MAX_REPORTED = 16,
+};
+
+static const char *check_names[CHECKS] = {
+	"pow(x, 2.0f)", "pown(x, 2)", "powr(|x|, 2.0f)", "fma(x, x, 0)",
+	"(x + x) * x * 0.5f",
 };
 
+/* Input element i, reproducible so reported indices can be recreated.
+ * Magnitudes 2^-60 to 2^61 keep x * x normal and finite. */
+static float check_input(uint64_t i)
+{
+	uint64_t state = (i + 1) * 0x9E3779B97F4A7C15ULL;
+	const uint64_t r = bench::rand64(state);
+	const float mantissa = 1.0f + (r >> 40) * (1.0f / (1 << 24));
+	const float x = std::ldexp(mantissa, (int)(r % 121) - 60);
+	return (r >> 32 & 1) ? -x : x;
+}
+
+/* Streams elements through the fused cross-check in pieces of up to
+ * CHECK_CHUNK that fit the device, the counters stay on the device until
+ * the end. The first chunk also runs the separate square and pow kernels
+ * for a traffic comparison. Builds with options and, if rows is given,
+ * adds a summary line per formulation to it. */
+static int run_crosscheck(const cl::Context &ctx,
+                          const cl::vector<cl::Device> &devices,
+                          uint64_t elements, const std::string &options = "",
+                          std::vector<std::string> *rows = NULL)
+{
+	/* input and the output of the separate kernels, on both sides */
+	const size_t chunk = bench::fit_elements(devices[0], CHECK_CHUNK,
+		2 * sizeof(float), sizeof(float), 2 * sizeof(float));
+	std::vector<float> data(chunk);
+	std::vector<cl_uint> counters(4 * CHECKS, 0);
+	std::fill(counters.begin() + 3 * CHECKS, counters.end(), ~0u);
+
+	double fused = 0, separate = 0, first_chunk = 0;
+	try {
+		cl::Program::Sources src(1,
+			std::make_pair(checkSource, std::strlen(checkSource)));
+		cl::Program prg(ctx, src);
+		try {
+			int ret = bench::build(prg, ctx, devices,
+			                       bench::build_options(options));
+			if (ret != CL_SUCCESS) {
+				std::cout <<"BUILD FAIL" << std::endl;
+			}
+		} catch (cl::Error e) {
+			std::cerr << "Build failed:\n" << e.what() << " "
+				<< e.err() << std::endl;
+			std::cerr << "BUILD LOG:\n" <<
+				prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+				<< "\nLOG DONE\n";
+			return 1;
+		}
+
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		const size_t bytes = chunk * sizeof(float);
+		cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY, bytes);
+		cl::Buffer cnt = bench::buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+			counters.size() * sizeof(cl_uint), &counters[0]);
+
+		cl::Kernel kernel(prg, "crosscheck");
+		kernel.setArg(0, in);
+		kernel.setArg(3, cnt);
+		const size_t local = std::min<size_t>(CHECK_LOCAL_SIZE,
+			kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]));
+		const size_t global = local * CHECK_GROUPS_PER_CU *
+			devices[0].getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+
+		for (uint64_t base = 0; base < elements; base += chunk) {
+			const size_t count = (size_t)std::min<uint64_t>(chunk,
+				elements - base);
+			bench::parallel_for(count, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i)
+					data[i] = check_input(base + i);
+			});
+			cmd.enqueueWriteBuffer(in, true, 0, count * sizeof(float),
+				&data[0]);
+			kernel.setArg(1, (unsigned)count);
+			kernel.setArg(2, (unsigned)base);
+			cl::Event ev;
+			cmd.enqueueNDRangeKernel(kernel, cl::NullRange,
+				cl::NDRange(global), cl::NDRange(local), NULL, &ev);
+			ev.wait();
+			fused += bench::event_seconds(ev);
+			if (base != 0)
+				continue;
+
+			/* separate tests: two reads, two writes, two readbacks */
+			first_chunk = bench::event_seconds(ev);
+			cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+			std::vector<float> results(count);
+			for (const char *name:{"square_sep", "pow_sep"}) {
+				cl::Kernel sep(prg, name);
+				sep.setArg(0, in);
+				sep.setArg(1, out);
+				cl::Event sep_ev, read_ev;
+				cmd.enqueueNDRangeKernel(sep, cl::NullRange,
+					cl::NDRange(count), cl::NullRange, NULL, &sep_ev);
+				cmd.enqueueReadBuffer(out, false, 0,
+					count * sizeof(float), &results[0], NULL, &read_ev);
+				read_ev.wait();
+				separate += bench::event_seconds(sep_ev) +
+					bench::event_seconds(read_ev);
+			}
+		}
+		cmd.enqueueReadBuffer(cnt, true, 0,
+			counters.size() * sizeof(cl_uint), &counters[0]);
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+
+	bench::report("fused cross-check", elements, fused,
+	              elements * sizeof(float));
+	std::cout << "First chunk: fused " << first_chunk * 1e3
+		<< " ms, separate square + pow with readback "
+		<< separate * 1e3 << " ms" << std::endl;
+
+	unsigned errors = 0;
+	for (unsigned c = 0; c < CHECKS; ++c) {
+		const cl_uint wrong = counters[CHECKS + c];
+		std::cout << check_names[c] << ": differs " << counters[c]
+			<< ", max ULP " << counters[2 * CHECKS + c]
+			<< ", wrong " << wrong << "/" << elements << std::endl;
+		if (wrong) {
+			const cl_uint first = counters[3 * CHECKS + c];
+			const float x = check_input(first);
+			std::cerr << "Incorrect element(" << first << ") "
+				<< check_names[c] << ": " << x << " correct: "
+				<< x * x << std::endl;
+		}
+		if (rows)
+			rows->push_back(std::string(check_names[c]) + ", " +
+				std::to_string(counters[c]) + ", " +
+				std::to_string(counters[2 * CHECKS + c]) + ", " +
+				std::to_string(wrong) + ", " +
+				std::to_string(fused ? elements / fused / 1e6 : 0));
+		errors += wrong;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+/* The cross-check once per compile option set, fast-relaxed-math and
+ * mad-enable may change how pow and the products round */
+static int run_matrix(const cl::Context &ctx,
+                      const cl::vector<cl::Device> &devices,
+                      uint64_t elements)
+{
+	std::vector<std::string> summary;
+	int ret = 0;
+	for (unsigned o = 0; o < bench::OPTION_SETS; ++o) {
+		std::cout << "Options: " << bench::option_sets[o].name << std::endl;
+		std::vector<std::string> rows;
+		const int r = run_crosscheck(ctx, devices, elements,
+			bench::option_sets[o].options, &rows);
+		if (r && o == 0)
+			ret = r;
+		for (const std::string &row:rows)
+			summary.push_back(std::string(bench::option_sets[o].name) +
+				", " + row);
+	}
+	std::cout << "options, formulation, differs, max ULP, wrong of "
+		<< elements << ", fused M/s" << std::endl;
+	for (const std::string &row:summary)
+		std::cout << row << std::endl;
+	return ret;
+}
+
 int main(int argc, const char*argv[])
 {
+	bench::memory_reporter memory;
+	/* --crosscheck runs the fused square/pow check over --elements=n
+	 * (default 256M) inputs instead of the 64 element test, --matrix
+	 * runs it once per compile option set */
+	bool crosscheck = false, matrix = false;
+	uint64_t elements = 256 * 1024 * 1024;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--crosscheck") {
+			crosscheck = true;
+		} else if (arg == "--matrix") {
+			matrix = true;
+		} else if (arg.compare(0, 11, "--elements=") == 0) {
+			elements = strtoull(arg.c_str() + 11, NULL, 10);
+		} else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+	/* indices are 32-bit on the device */
+	if (elements == 0 || elements > 0xffffffffULL) {
+		std::cerr << "Element count out of range" << std::endl;
+		return 1;
+	}
+
 	float data[DATA_SIZE];       // original data set given to device
 	float results[DATA_SIZE];    // results returned from device
 
+	bench::perf::scope perf_input("input", DATA_SIZE);
         for(unsigned i = 0; i < DATA_SIZE; i++)
 	        data[i] = rand() / (float)RAND_MAX;
+	perf_input.end();
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -58,18 +339,27 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
+	if (matrix || crosscheck)
+		bench::trace::phase("run");
+	if (matrix)
+		return run_matrix(ctx, devices, elements);
+	if (crosscheck)
+		return run_crosscheck(ctx, devices, elements);
+
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer in(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
+	cl::Buffer in = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(data), data);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -85,6 +375,7 @@ int main(int argc, const char*argv[])
 	}
 
 
+	bench::trace::phase("run");
 	/* Create kernel and set arguments */
 	try {
 		cl::Kernel kernel(prg, "square");
@@ -112,6 +403,7 @@ int main(int argc, const char*argv[])
 		return 1;
 	}
 	unsigned errors = 0;
+	bench::perf::scope perf_verify("verify", DATA_SIZE);
 	for (int i = 0; i < DATA_SIZE; ++i) {
 		float result = data[i] * data[i];
 		if (result != results[i]) {
@@ -121,6 +413,7 @@ int main(int argc, const char*argv[])
 				<< " correct: " << result << std::endl;
 		}
 	}
+	perf_verify.end();
 
 	std::cout << "Wrong: " << errors << "/" << DATA_SIZE << std::endl;
 
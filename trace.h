@@ -0,0 +1,271 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Host/device timeline trace, enabled with BENCH_TRACE=<file.json>.
+ * Host spans come from bench::trace::scope and bench::trace::phase and
+ * go to a per-thread ring buffer (oldest spans are overwritten), profiled
+ * OpenCL events are added by bench::event_seconds() on a row per device,
+ * each with its own clock offset. At exit everything is written as a
+ * Chrome/Perfetto JSON trace. Without BENCH_TRACE every call is a single
+ * cached flag test. Included by bench.h. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace bench {
+namespace trace {
+
+enum {
+	RING_SIZE = 1 << 14,
+	/* every device gets its own row in the viewer, DEVICE_TID + index */
+	DEVICE_TID = 1000000,
+};
+
+struct span {
+	const char *name;
+	uint64_t begin;
+	uint64_t end;
+	uint32_t tid;
+};
+
+struct ring {
+	span spans[RING_SIZE];
+	uint64_t count;
+};
+
+static inline bool enabled()
+{
+	static const bool on = getenv("BENCH_TRACE") != NULL;
+	return on;
+}
+
+/* Host monotonic clock in ns, the same clock bench::now() uses */
+static inline uint64_t now_ns()
+{
+	return ::std::chrono::duration_cast< ::std::chrono::nanoseconds>(
+		::std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Device clock of one device, mapped to the host clock with offset */
+struct device_clock {
+	cl_device_id id;
+	::std::string name;
+	int64_t offset;
+};
+
+/* Rings of exited threads are reused by new ones (parallel_for starts
+ * fresh threads on every call), every span keeps its writer's tid. The
+ * destructor writes the trace file at exit. */
+class state {
+public:
+	state() : next_tid(0) {}
+	~state() { write(getenv("BENCH_TRACE")); }
+
+	ring *acquire(uint32_t &tid)
+	{
+		::std::lock_guard< ::std::mutex> guard(lock);
+		tid = next_tid++;
+		if (!free.empty()) {
+			ring *r = free.back();
+			free.pop_back();
+			return r;
+		}
+		ring *r = new ring;
+		r->count = 0;
+		all.push_back(r);
+		return r;
+	}
+	void release(ring *r)
+	{
+		::std::lock_guard< ::std::mutex> guard(lock);
+		free.push_back(r);
+	}
+	/* Device timestamps are mapped with the smallest host - device end
+	 * difference seen on that device, the host clock is read after the
+	 * event completed so that is the tightest bound on the real offset.
+	 * Every device has its own clock. Returns the device's row. */
+	uint32_t calibrate(cl_device_id id, int64_t offset)
+	{
+		::std::lock_guard< ::std::mutex> guard(lock);
+		size_t d = 0;
+		while (d < devices.size() && devices[d].id != id)
+			++d;
+		if (d == devices.size()) {
+			char name[256] = "";
+			clGetDeviceInfo(id, CL_DEVICE_NAME, sizeof(name) - 1,
+			                name, NULL);
+			const device_clock clock = { id, name, INT64_MAX };
+			devices.push_back(clock);
+		}
+		devices[d].offset = ::std::min(devices[d].offset, offset);
+		return DEVICE_TID + d;
+	}
+private:
+	void write(const char *path)
+	{
+		if (!path)
+			return;
+		FILE *f = fopen(path, "w");
+		if (!f) {
+			perror(path);
+			return;
+		}
+		fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		const char *sep = "";
+		for (size_t d = 0; d < devices.size(); ++d, sep = ",\n")
+			fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+				"\"pid\": 1, \"tid\": %u, \"args\": {\"name\": "
+				"\"device %zu %s\"}}", sep, (unsigned)(DEVICE_TID + d),
+				d, devices[d].name.c_str());
+		for (uint32_t t = 0; t < next_tid; ++t, sep = ",\n")
+			fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+				"\"pid\": 1, \"tid\": %u, \"args\": {\"name\": "
+				"\"host %u\"}}", sep, t, t);
+		for (const ring *r:all) {
+			const uint64_t first = r->count > RING_SIZE ?
+				r->count - RING_SIZE : 0;
+			for (uint64_t i = first; i < r->count; ++i) {
+				const span &s = r->spans[i % RING_SIZE];
+				int64_t begin = s.begin, end = s.end;
+				if (s.tid >= DEVICE_TID) {
+					const int64_t offset =
+						devices[s.tid - DEVICE_TID].offset;
+					begin += offset;
+					end += offset;
+				}
+				fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"X\", "
+					"\"pid\": 1, \"tid\": %u, \"ts\": %.3f, "
+					"\"dur\": %.3f}", sep, s.name, s.tid,
+					begin / 1e3, (end - begin) / 1e3);
+				sep = ",\n";
+			}
+		}
+		fprintf(f, "\n]}\n");
+		fclose(f);
+	}
+
+	::std::mutex lock;
+	::std::vector<ring *> all, free;
+	uint32_t next_tid;
+	::std::vector<device_clock> devices;
+};
+
+static inline state &global()
+{
+	static state s;
+	return s;
+}
+
+/* This thread's ring and the phase it is in, returned to the pool when
+ * the thread exits */
+class local_ring {
+public:
+	local_ring() : r(global().acquire(tid)), phase(NULL), phase_begin(0) {}
+	~local_ring()
+	{
+		end_phase();
+		global().release(r);
+	}
+	void add(const char *name, uint64_t begin, uint64_t end,
+	         uint32_t span_tid)
+	{
+		span &s = r->spans[r->count++ % RING_SIZE];
+		s.name = name;
+		s.begin = begin;
+		s.end = end;
+		s.tid = span_tid;
+	}
+	void add(const char *name, uint64_t begin, uint64_t end)
+	{
+		add(name, begin, end, tid);
+	}
+	void start_phase(const char *name)
+	{
+		const uint64_t t = now_ns();
+		if (phase)
+			add(phase, phase_begin, t);
+		phase = name;
+		phase_begin = t;
+	}
+	void end_phase() { start_phase(NULL); }
+private:
+	ring *r;
+	uint32_t tid;
+	const char *phase;
+	uint64_t phase_begin;
+};
+
+static inline local_ring &local()
+{
+	static thread_local local_ring l;
+	return l;
+}
+
+/* Span covering the lifetime of the object, name must be a literal */
+class scope {
+public:
+	explicit scope(const char *what)
+		: name(enabled() ? what : NULL), begin(name ? now_ns() : 0) {}
+	~scope()
+	{
+		if (name)
+			local().add(name, begin, now_ns());
+	}
+private:
+	scope(const scope &);
+	scope &operator=(const scope &);
+	const char *name;
+	uint64_t begin;
+};
+
+/* Ends this thread's current phase and starts the next one, phases run
+ * back to back until NULL or thread exit */
+static inline void phase(const char *name)
+{
+	if (enabled())
+		local().start_phase(name);
+}
+
+/* Device span from the profiling timestamps of ev, called once the
+ * event is done */
+static inline void device(const char *name, const cl::Event &ev,
+                          cl_ulong start, cl_ulong end)
+{
+	if (!enabled())
+		return;
+	const int64_t offset = (int64_t)now_ns() - (int64_t)end;
+	cl_command_queue queue = NULL;
+	cl_device_id id = NULL;
+	clGetEventInfo(ev(), CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue,
+	               NULL);
+	clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(id), &id, NULL);
+	local().add(name, start, end, global().calibrate(id, offset));
+}
+
+static inline const char *command_name(cl_uint type)
+{
+	switch (type) {
+	case CL_COMMAND_NDRANGE_KERNEL: return "kernel";
+	case CL_COMMAND_READ_BUFFER: return "read buffer";
+	case CL_COMMAND_WRITE_BUFFER: return "write buffer";
+	case CL_COMMAND_COPY_BUFFER: return "copy buffer";
+	case CL_COMMAND_FILL_BUFFER: return "fill buffer";
+	case CL_COMMAND_READ_IMAGE: return "read image";
+	case CL_COMMAND_WRITE_IMAGE: return "write image";
+	case CL_COMMAND_MAP_BUFFER: return "map buffer";
+	case CL_COMMAND_UNMAP_MEM_OBJECT: return "unmap";
+	case CL_COMMAND_MARKER: return "marker";
+	default: return "command";
+	}
+}
+
+}
+}
+
+#endif
@@ -6,6 +6,9 @@
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+
 // Simple compute kernel which computes the square of an input array
 
 const char kernelSource[] = "              \n" \
@@ -43,16 +46,20 @@ enum {
 
 int main(void)
 {
+	bench::memory_reporter memory;
 	unsigned char dataA[DATA_SIZE];       // original data set given to device
 	unsigned char dataB[DATA_SIZE];       // original data set given to device
 	unsigned char resD[DATA_SIZE];       // original data set given to device
 	unsigned char resR[DATA_SIZE];       // original data set given to device
 
+	bench::perf::scope perf_input("input", DATA_SIZE);
         for(unsigned i = 0; i < DATA_SIZE; i++) {
 	        dataA[i] = i % UCHAR_MAX;
 	        dataB[i] = (i / UCHAR_MAX) + 1;
 	}
+	perf_input.end();
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -80,20 +87,22 @@ int main(void)
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer inA(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataA), dataA);
-	cl::Buffer inB(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataB), dataB);
-	cl::Buffer outD(ctx, CL_MEM_WRITE_ONLY, sizeof(resD));
-	cl::Buffer outR(ctx, CL_MEM_WRITE_ONLY, sizeof(resR));
+	cl::Buffer inA = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataA), dataA);
+	cl::Buffer inB = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataB), dataB);
+	cl::Buffer outD = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(resD));
+	cl::Buffer outR = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(resR));
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -109,6 +118,7 @@ int main(void)
 	}
 
 
+	bench::trace::phase("run");
 	/* Create kernel and set arguments */
 	try {
 		cl::Kernel kernel(prg, "udivrem");
@@ -139,6 +149,7 @@ int main(void)
 		return 1;
 	}
 	unsigned errors = 0;
+	bench::perf::scope perf_verify("verify", DATA_SIZE);
 	for (int i = 0; i < DATA_SIZE; ++i) {
 		unsigned char resultD = dataB[i] != 0 ? dataA[i] / dataB[i] : 0;
 		unsigned char resultR = dataB[i] != 0 ? dataA[i] % dataB[i] : 0;
@@ -151,6 +162,7 @@ int main(void)
 				 << std::endl;
 		}
 	}
+	perf_verify.end();
 
 	std::cout << "Wrong: " << errors << "/" << DATA_SIZE << std::endl;
 
@@ -6,6 +6,10 @@
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
+#include "bench.h"
+#include "program.h"
+#include "golden.h"
+
 // Simple compute kernel which computes the square of an input array
 
 const char kernelSource[] = "              \n" \
@@ -43,18 +47,22 @@ enum {
 
 int main(void)
 {
+	bench::memory_reporter memory;
 	cl_ulong dataA[DATA_SIZE]; // original data set given to device
 	cl_ulong dataB[DATA_SIZE]; // original data set given to device
 	cl_ulong resD[DATA_SIZE];  // result data set
 	cl_ulong resR[DATA_SIZE];  // result data set
 
+	bench::perf::scope perf_input("input", DATA_SIZE);
         for(unsigned i = 0; i < DATA_SIZE; i++) {
 	        dataA[i] = i % UCHAR_MAX;
 	        dataB[i] = (i / UCHAR_MAX) + 1;
 	}
+	perf_input.end();
 	dataA[0] = 1;
 	dataB[0] = 0xffffffffffffffffUL;
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -82,20 +90,22 @@ int main(void)
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer inA(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataA), dataA);
-	cl::Buffer inB(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataB), dataB);
-	cl::Buffer outD(ctx, CL_MEM_WRITE_ONLY, sizeof(resD));
-	cl::Buffer outR(ctx, CL_MEM_WRITE_ONLY, sizeof(resR));
+	cl::Buffer inA = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataA), dataA);
+	cl::Buffer inB = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, sizeof(dataB), dataB);
+	cl::Buffer outD = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(resD));
+	cl::Buffer outR = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(resR));
 
+	bench::trace::phase("build");
 	/* Create program from source */
 	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -111,6 +121,7 @@ int main(void)
 	}
 
 
+	bench::trace::phase("run");
 	/* Create kernel and set arguments */
 	try {
 		cl::Kernel kernel(prg, "udivrem");
@@ -141,9 +152,21 @@ int main(void)
 		return 1;
 	}
 	unsigned errors = 0;
+	bench::perf::scope perf_verify("verify", DATA_SIZE);
+	/* quotient and remainder interleaved, the inputs are fixed */
+	bench::golden<cl_ulong> golden("udivrem64", "udivrem", 0, 0,
+	                               2 * DATA_SIZE);
+	const cl_ulong *expected = golden.get(
+		[&](cl_ulong *ref, size_t begin, size_t end) {
+			for (size_t k = begin; k < end; ++k) {
+				const size_t i = k / 2;
+				ref[k] = dataB[i] == 0 ? 0 : k % 2 ?
+					dataA[i] % dataB[i] : dataA[i] / dataB[i];
+			}
+		});
 	for (int i = 0; i < DATA_SIZE; ++i) {
-		cl_ulong resultD = dataB[i] != 0 ? dataA[i] / dataB[i] : 0;
-		cl_ulong resultR = dataB[i] != 0 ? dataA[i] % dataB[i] : 0;
+		cl_ulong resultD = expected[2 * i];
+		cl_ulong resultR = expected[2 * i + 1];
 		bool error = false;
 		std::cerr << std::hex;
 		if (resultD != resD[i]){
@@ -164,6 +187,7 @@ int main(void)
 		}
 		errors += error;
 	}
+	perf_verify.end();
 
 	std::cout << "Wrong: " << errors << "/" << DATA_SIZE << std::endl;
 
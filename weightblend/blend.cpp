@@ -1,18 +1,22 @@
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 #define __NO_STD_VECTOR // Use cl::vector instead of STL version
 #define __CL_ENABLE_EXCEPTIONS
 #include <CL/cl.hpp>
 
-const char kernelSource[] = "             \n" \
-"__kernel void cl_weighted_blend(__global const float4 *in, \n"
-"                                __global const float4 *aux, \n"
-"                                __global       float4 *out) \n"
+#include "bench.h"
+#include "program.h"
+
+/* Blend math shared by every kernel below, built in front of each of
+ * the sources with blend_sources() */
+const char blendSource[] = "             \n" \
+"float4 blend(float4 in_v, float4 aux_v) \n"
 "{ \n"
-"  int gid = get_global_id(0); \n"
-"  float4 in_v = in[gid]; \n"
-"  float4 aux_v = aux[gid]; \n"
 "  float4 out_v; \n"
 "  float in_weight; \n"
 "  float aux_weight; \n"
@@ -25,17 +29,860 @@ const char kernelSource[] = "             \n" \
 " \n"
 "  out_v.xyz = in_weight * in_v.xyz + aux_weight * aux_v.xyz; \n"
 "  out_v.w = total_alpha; \n"
-"  out[gid] = out_v; \n"
+"  return out_v; \n"
+"} \n";
+
+const char kernelSource[] = "             \n" \
+"__kernel void cl_weighted_blend(__global const float4 *in, \n"
+"                                __global const float4 *aux, \n"
+"                                __global       float4 *out) \n"
+"{ \n"
+"  int gid = get_global_id(0); \n"
+"  float4 in_v = in[gid]; \n"
+"  float4 aux_v = aux[gid]; \n"
+"  out[gid] = blend(in_v, aux_v); \n"
+"} \n"
+" \n"
+"/* Composites count layers stored stride float4s apart in one buffer, \n"
+" * same as count - 1 chained cl_weighted_blend passes but in one pass. */ \n"
+"__kernel void cl_weighted_blend_layers(__global const float4 *layers, \n"
+"                                       __global       float4 *out, \n"
+"                                       unsigned count, \n"
+"                                       unsigned stride) \n"
+"{ \n"
+"  int gid = get_global_id(0); \n"
+"  float4 in_v = layers[gid]; \n"
+"  for (unsigned l = 1; l < count; ++l) { \n"
+"    float4 aux_v = layers[(size_t)l * stride + gid]; \n"
+"    in_v = blend(in_v, aux_v); \n"
+"  } \n"
+"  out[gid] = in_v; \n"
+"} \n"
+" \n"
+"/* 2D version for pitched frames, launched with 2D work-groups */ \n"
+"__kernel void cl_weighted_blend_2d(__global const float4 *in, \n"
+"                                   __global const float4 *aux, \n"
+"                                   __global       float4 *out, \n"
+"                                   int width, int height, int pitch) \n"
+"{ \n"
+"  int x = get_global_id(0); \n"
+"  int y = get_global_id(1); \n"
+"  if (x >= width || y >= height) \n"
+"    return; \n"
+"  size_t gid = (size_t)y * pitch + x; \n"
+"  float4 in_v = in[gid]; \n"
+"  float4 aux_v = aux[gid]; \n"
+"  out[gid] = blend(in_v, aux_v); \n"
+"} \n";
+
+/* cl_weighted_blend reading and writing RGBA float images */
+const char imageSource[] = "             \n" \
+"__constant sampler_t blend_sampler = CLK_NORMALIZED_COORDS_FALSE | \n"
+"                                     CLK_ADDRESS_CLAMP_TO_EDGE | \n"
+"                                     CLK_FILTER_NEAREST; \n"
+"__kernel void cl_weighted_blend_image(__read_only image2d_t in, \n"
+"                                      __read_only image2d_t aux, \n"
+"                                      __write_only image2d_t out) \n"
+"{ \n"
+"  int2 pos = (int2)(get_global_id(0), get_global_id(1)); \n"
+"  float4 in_v = read_imagef(in, blend_sampler, pos); \n"
+"  float4 aux_v = read_imagef(aux, blend_sampler, pos); \n"
+"  write_imagef(out, pos, blend(in_v, aux_v)); \n"
 "} \n";
 
+/* cl_weighted_blend with the pixel storage format selected by
+ * -DHALF or -DUCHAR (normalized), default float4. Math stays float. */
+const char storageSource[] = "             \n" \
+"#if defined(HALF) \n"
+"typedef half pixel; \n"
+"#define LOAD(i, p) vload_half4(i, p) \n"
+"#define STORE(v, i, p) vstore_half4(v, i, p) \n"
+"#elif defined(UCHAR) \n"
+"typedef uchar4 pixel; \n"
+"#define LOAD(i, p) (convert_float4((p)[i]) * (1.0f / 255.0f)) \n"
+"#define STORE(v, i, p) (p)[i] = convert_uchar4_sat_rte((v) * 255.0f) \n"
+"#else \n"
+"typedef float4 pixel; \n"
+"#define LOAD(i, p) (p)[i] \n"
+"#define STORE(v, i, p) (p)[i] = (v) \n"
+"#endif \n"
+"__kernel void cl_weighted_blend_storage(__global const pixel *in, \n"
+"                                        __global const pixel *aux, \n"
+"                                        __global       pixel *out) \n"
+"{ \n"
+"  int gid = get_global_id(0); \n"
+"  float4 in_v = LOAD(gid, in); \n"
+"  float4 aux_v = LOAD(gid, aux); \n"
+"  STORE(blend(in_v, aux_v), gid, out); \n"
+"} \n";
 
 
 enum {
 	DATA_SIZE = 64,
+	/* frame stream mode */
+	SLOTS = 2,          // double buffering
+	POOL = 2,           // distinct source frames cycled through
+	BENCH_SAMPLE = 16,  // verify every n-th frame in bench mode
+	MAX_REPORTED = 16,
+	/* storage precision mode */
+	PRECISION_RUNS = 10,
+	/* buffer vs image mode */
+	IMAGE_RUNS = 10,
+	/* 2D tiled mode */
+	PITCH_PAD = 64,     // row padding in pixels
+	TILE_RUNS = 10,
+	/* multi-layer mode */
+	MAX_LAYERS = 16,
+	LAYER_RUNS = 5,
+};
+
+/* The kernel may contract into fma, so stream frames are compared with
+ * a relative tolerance instead of the exact check above. */
+static const float STREAM_TOLERANCE = 1e-5f;
+
+/* blendSource followed by source */
+static cl::Program::Sources blend_sources(const char *source)
+{
+	cl::Program::Sources src(1, std::make_pair(blendSource, std::strlen(blendSource)));
+	src.push_back(std::make_pair(source, std::strlen(source)));
+	return src;
+}
+
+/* Host version of blend() in blendSource for one pixel */
+static void blend_pixel(const float *in, const float *aux, float *out)
+{
+	float total_alpha = in[3] + aux[3];
+	total_alpha = total_alpha == 0 ? 1 : total_alpha;
+	const float in_w = in[3] / total_alpha;
+	const float aux_w = 1.0f - in_w;
+	for (unsigned c = 0; c < 3; ++c)
+		out[c] = in_w * in[c] + aux_w * aux[c];
+	out[3] = total_alpha;
+}
+
+static float to_float(unsigned code)
+{
+	union {
+		float f;
+		unsigned u;
+	} conv;
+	conv.u = code;
+	return conv.f;
+}
+static unsigned to_uint(float num)
+{
+	union {
+		float f;
+		unsigned u;
+	} conv;
+	conv.f = num;
+	return conv.u;
+}
+
+/* float -> half, round to nearest even */
+static cl_half to_half(float num)
+{
+	const unsigned u = to_uint(num);
+	const unsigned sign = (u >> 16) & 0x8000;
+	const int exp = (int)((u >> 23) & 0xff) - 127 + 15;
+	unsigned mant = u & 0x7fffff;
+	if (((u >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mant ? 0x200 : 0);
+	if (exp >= 31)
+		return sign | 0x7c00;
+	unsigned shift = 13;
+	unsigned h = sign | (exp << 10);
+	if (exp <= 0) {
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		shift = 14 - exp;
+		h = sign;
+	}
+	const unsigned rem = mant & ((1u << shift) - 1);
+	const unsigned halfway = 1u << (shift - 1);
+	h += mant >> shift;
+	/* a carry out of the mantissa correctly bumps the exponent */
+	if (rem > halfway || (rem == halfway && (h & 1)))
+		++h;
+	return h;
+}
+
+static float from_half(cl_half h)
+{
+	const unsigned sign = (h & 0x8000u) << 16;
+	const unsigned exp = (h >> 10) & 0x1f;
+	const unsigned mant = h & 0x3ff;
+	if (exp == 0) {
+		const float f = mant * (1.0f / (1 << 24));
+		return sign ? -f : f;
+	}
+	if (exp == 31)
+		return to_float(sign | 0x7f800000 | (mant << 13));
+	return to_float(sign | ((exp - 15 + 127) << 23) | (mant << 13));
+}
+
+static cl_half encode_half(float v) { return to_half(v); }
+static float decode_half(cl_half v) { return from_half(v); }
+static cl_uchar encode_uchar(float v) { return (cl_uchar)lrintf(v * 255.0f); }
+static float decode_uchar(cl_uchar v) { return v / 255.0f; }
+static float encode_float(float v) { return v; }
+static float decode_float(float v) { return v; }
+
+/* Runs cl_weighted_blend_storage for one storage type T on 8-bit source
+ * frames and compares with the float blend of the same source values.
+ * Returns the number of channels off by more than bound, or -1. */
+template<typename T>
+static long run_storage(const cl::Context &ctx,
+                        const cl::vector<cl::Device> &devices,
+                        const char *name, const char *define, float bound,
+                        T (*encode)(float), float (*decode)(T),
+                        const std::vector<float> &in,
+                        const std::vector<float> &aux,
+                        const std::vector<float> &reference)
+{
+	const size_t count = in.size();
+	const size_t bytes = count * sizeof(T);
+	std::vector<T> in_s(count), aux_s(count), results(count);
+	for (size_t i = 0; i < count; ++i) {
+		in_s[i] = encode(in[i]);
+		aux_s[i] = encode(aux[i]);
+	}
+
+	const cl::Program::Sources src = blend_sources(storageSource);
+	cl::Program prg(ctx, src);
+	try {
+		int ret = bench::build(prg, ctx, devices, bench::build_options(define));
+		if (ret != CL_SUCCESS) {
+			std::cout <<"BUILD FAIL" << std::endl;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Build failed:\n" << e.what() << " "
+			<< e.err() << std::endl;
+		std::cerr << "BUILD LOG:\n" <<
+			prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+			<< "\nLOG DONE\n";
+		return -1;
+	}
+
+	double best = 0;
+	try {
+		cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &in_s[0]);
+		cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &aux_s[0]);
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		cl::Kernel kernel(prg, "cl_weighted_blend_storage");
+		kernel.setArg(0, in1);
+		kernel.setArg(1, in2);
+		kernel.setArg(2, out);
+		best = bench::best_time(cmd, kernel, cl::NDRange(count / 4),
+		                        cl::NullRange, PRECISION_RUNS);
+		cmd.enqueueReadBuffer(out, true, 0, bytes, &results[0]);
+	} catch (cl::Error e) {
+		std::cerr << "Kernel failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return -1;
+	}
+
+	float max_error = 0;
+	long errors = 0;
+	bench::perf::scope perf("verify", count);
+	bench::parallel_for(count, [&](size_t begin, size_t end) {
+		float local_max = 0;
+		long local_errors = 0;
+		for (size_t i = begin; i < end; ++i) {
+			const float err = std::fabs(decode(results[i]) - reference[i]);
+			local_max = std::max(local_max, err);
+			local_errors += !(err <= bound);
+		}
+		std::lock_guard<std::mutex> guard(bench::log_lock());
+		max_error = std::max(max_error, local_max);
+		errors += local_errors;
+	});
+	bench::report(name, count / 4, best, 3 * bytes);
+	std::cout << "\tmax error: " << max_error << " bound: " << bound
+		<< " over bound: " << errors << "/" << count << std::endl;
+	return errors;
+}
+
+/* True when RGBA float frames of pixels fit, device_frames of them in
+ * device memory and host_frames on the host */
+static bool frames_fit(const cl::Device &dev, size_t pixels,
+                       unsigned device_frames, unsigned host_frames)
+{
+	const size_t frame = 4 * sizeof(float);
+	return bench::fit_elements(dev, pixels, device_frames * frame, frame,
+	                           host_frames * frame) == pixels;
+}
+
+/* Compares float4, half4 and normalized uchar4 pixel storage. Source
+ * values are 8-bit (k / 255) like the production input, alphas are at
+ * most 127 / 255 so the blended alpha fits the uchar4 range. */
+static int run_precision(const cl::Context &ctx,
+                         const cl::vector<cl::Device> &devices,
+                         unsigned width, unsigned height)
+{
+	/* three float frames on the device; the float inputs, reference and
+	 * the converted copies on the host */
+	if (!frames_fit(devices[0], (size_t)width * height, 3, 6)) {
+		std::cout << "Storage precision at " << width << "x" << height
+			<< ": not enough memory, skipped" << std::endl;
+		return 0;
+	}
+	const size_t count = (size_t)width * height * 4;
+	std::vector<float> in(count), aux(count), reference(count);
+	uint64_t seed = 0xda3e39cb94b95bdbULL;
+	for (size_t i = 0; i < count; ++i) {
+		const unsigned limit = i % 4 == 3 ? 128 : 256;
+		in[i] = (bench::rand64(seed) % limit) / 255.0f;
+		aux[i] = (bench::rand64(seed) % limit) / 255.0f;
+	}
+	bench::parallel_for(count / 4, [&](size_t begin, size_t end) {
+		for (size_t p = begin; p < end; ++p)
+			blend_pixel(&in[p * 4], &aux[p * 4], &reference[p * 4]);
+	});
+
+	std::cout << "Storage precision at " << width << "x" << height
+		<< std::endl;
+	/* float: fma contraction noise; half: 2^-12 input and output
+	 * rounding plus 2^-10 from the rounded alpha weights; uchar: output
+	 * rounding to 1/255 steps with some float slack */
+	const long e_float = run_storage<float>(ctx, devices, "float4", "",
+		2e-5f, encode_float, decode_float, in, aux, reference);
+	const long e_half = run_storage<cl_half>(ctx, devices, "half4",
+		"-DHALF", 1.0f / 512, encode_half, decode_half, in, aux,
+		reference);
+	const long e_uchar = run_storage<cl_uchar>(ctx, devices, "uchar4",
+		"-DUCHAR", 1.0f / 255, encode_uchar, decode_uchar, in, aux,
+		reference);
+	if (e_float < 0 || e_half < 0 || e_uchar < 0)
+		return 1;
+	return e_float + e_half + e_uchar ? 1 : 0;
+}
+
+/* Checks one blended pixel, the expected value is left in res */
+static bool blend_ok(const float *in, const float *aux, const float *result,
+                     float *res)
+{
+	blend_pixel(in, aux, res);
+	bool ok = true;
+	for (unsigned c = 0; c < 4; ++c)
+		ok &= std::fabs(res[c] - result[c]) <=
+			STREAM_TOLERANCE * std::max(1.0f, std::fabs(res[c]));
+	return ok;
+}
+
+static unsigned verify_frame(unsigned frame, const float *in, const float *aux,
+                             const float *results, size_t pixels)
+{
+	unsigned errors = 0, reported = 0;
+	bench::perf::scope perf("verify", pixels);
+	bench::parallel_for(pixels, [&](size_t begin, size_t end) {
+		unsigned local_errors = 0;
+		for (size_t p = begin; p < end; ++p) {
+			const size_t i = p * 4;
+			float res[4];
+			if (blend_ok(in + i, aux + i, results + i, res))
+				continue;
+			++local_errors;
+			std::lock_guard<std::mutex> guard(bench::log_lock());
+			if (reported++ >= MAX_REPORTED)
+				continue;
+			std::cerr << "Incorrect frame " << frame << " element("
+				<< p << "): RES(" << results[i] << ", "
+				<< results[i+1] << ", " << results[i+2] << ", "
+				<< results[i+3] << ") CORRECT(" << res[0] << ", "
+				<< res[1] << ", " << res[2] << ", " << res[3]
+				<< ")\n";
+		}
+		std::lock_guard<std::mutex> guard(bench::log_lock());
+		errors += local_errors;
+	});
+	return errors;
+}
+
+/* Random in/aux RGBA frames with some fully transparent pairs for the
+ * total_alpha == 0 path */
+static void random_frames(std::vector<float> &in, std::vector<float> &aux,
+                          size_t pixels, uint64_t &seed, unsigned offset)
+{
+	in.resize(pixels * 4);
+	aux.resize(pixels * 4);
+	for (size_t i = 0; i < pixels * 4; ++i) {
+		in[i] = bench::randf(seed);
+		aux[i] = bench::randf(seed);
+	}
+	for (size_t p = offset; p < pixels; p += 997)
+		in[p * 4 + 3] = aux[p * 4 + 3] = 0;
+}
+
+/* Blends a sequence of width x height RGBA float frames. Each slot has
+ * its own in/aux/out buffers and its own in-order queue, so uploads,
+ * the kernel and readback of one frame overlap with the other slot.
+ * A slot is reused only after its previous frame was read back. */
+static int run_stream(const cl::Context &ctx, const cl::Device &device,
+                      const cl::Program &prg, unsigned width,
+                      unsigned height, unsigned frames, bool bench_mode)
+{
+	const size_t pixels = (size_t)width * height;
+	const size_t bytes = pixels * 4 * sizeof(float);
+	std::cout << "Streaming " << frames << " frames of " << width << "x"
+		<< height << " (" << bytes / (1024 * 1024) << " MiB per buffer)"
+		<< (bench_mode ? ", bench mode" : "") << std::endl;
+	if (!frames_fit(device, pixels, SLOTS * 3, POOL * 2 + SLOTS)) {
+		std::cout << "\tnot enough memory for " << SLOTS
+			<< " slots, skipped" << std::endl;
+		return 0;
+	}
+
+	std::vector<std::vector<float> > in(POOL), aux(POOL), results(SLOTS);
+	uint64_t seed = 0x853c49e6748fea9bULL;
+	for (unsigned f = 0; f < POOL; ++f)
+		random_frames(in[f], aux[f], pixels, seed, f);
+	for (unsigned s = 0; s < SLOTS; ++s)
+		results[s].resize(pixels * 4);
+
+	std::vector<double> latency, kernel_time;
+	unsigned errors = 0, verified = 0;
+	double start, end;
+	try {
+		cl::CommandQueue queue[SLOTS];
+		cl::Buffer in_buf[SLOTS], aux_buf[SLOTS], out_buf[SLOTS];
+		cl::Kernel kernel[SLOTS];
+		for (unsigned s = 0; s < SLOTS; ++s) {
+			queue[s] = cl::CommandQueue(ctx, device, CL_QUEUE_PROFILING_ENABLE);
+			in_buf[s] = bench::buffer(ctx, CL_MEM_READ_ONLY, bytes);
+			aux_buf[s] = bench::buffer(ctx, CL_MEM_READ_ONLY, bytes);
+			out_buf[s] = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+			kernel[s] = cl::Kernel(prg, "cl_weighted_blend");
+			kernel[s].setArg(0, in_buf[s]);
+			kernel[s].setArg(1, aux_buf[s]);
+			kernel[s].setArg(2, out_buf[s]);
+		}
+
+		cl::Event upload[SLOTS], run[SLOTS], download[SLOTS];
+		start = bench::now();
+		for (unsigned f = 0; f < frames + SLOTS; ++f) {
+			const unsigned s = f % SLOTS;
+			/* retire the frame that used this slot before */
+			if (f >= SLOTS) {
+				const unsigned done = f - SLOTS;
+				download[s].wait();
+				latency.push_back((download[s].getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+					upload[s].getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) * 1e-9);
+				kernel_time.push_back(bench::event_seconds(run[s]));
+				const bool sample = !bench_mode ||
+					done % BENCH_SAMPLE == 0 || done == frames - 1;
+				if (sample) {
+					errors += verify_frame(done,
+						&in[done % POOL][0], &aux[done % POOL][0],
+						&results[s][0], pixels);
+					++verified;
+				}
+			}
+			if (f >= frames)
+				continue;
+			queue[s].enqueueWriteBuffer(in_buf[s], false, 0, bytes,
+				&in[f % POOL][0], NULL, &upload[s]);
+			queue[s].enqueueWriteBuffer(aux_buf[s], false, 0, bytes,
+				&aux[f % POOL][0]);
+			queue[s].enqueueNDRangeKernel(kernel[s], cl::NDRange(0),
+				cl::NDRange(pixels), cl::NullRange, NULL, &run[s]);
+			queue[s].enqueueReadBuffer(out_buf[s], false, 0, bytes,
+				&results[s][0], NULL, &download[s]);
+			queue[s].flush();
+		}
+		end = bench::now();
+	} catch (cl::Error e) {
+		std::cerr << "Stream failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+
+	double kernel_total = 0;
+	for (double t : kernel_time)
+		kernel_total += t;
+	const double wall = end - start;
+	std::cout << "Frames/s: " << frames / wall << std::endl;
+	std::cout << "Kernel: " << 3.0 * bytes * frames / kernel_total / 1e9
+		<< " GB/s, end to end (incl. transfers): "
+		<< 3.0 * bytes * frames / wall / 1e9 << " GB/s" << std::endl;
+	std::cout << "Frame latency ms: p50 "
+		<< bench::percentile(latency, 50) * 1e3 << " p90 "
+		<< bench::percentile(latency, 90) * 1e3 << " p99 "
+		<< bench::percentile(latency, 99) * 1e3 << " max "
+		<< bench::percentile(latency, 100) * 1e3 << std::endl;
+	std::cout << "Wrong: " << errors << "/" << (size_t)verified * pixels
+		<< " (" << verified << "/" << frames << " frames verified)"
+		<< std::endl;
+	return errors ? 1 : 0;
+}
+
+/* Runs the buffer kernel and cl_weighted_blend_image side by side on
+ * frames of several sizes and verifies the image results. */
+static int run_image(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const cl::Program &prg, bool big)
+{
+	if (!devices[0].getInfo<CL_DEVICE_IMAGE_SUPPORT>()) {
+		std::cout << "Device has no image support" << std::endl;
+		return 0;
+	}
+	const cl::Program::Sources src = blend_sources(imageSource);
+	cl::Program img_prg(ctx, src);
+	try {
+		int ret = bench::build(img_prg, ctx, devices, bench::build_options());
+		if (ret != CL_SUCCESS) {
+			std::cout <<"BUILD FAIL" << std::endl;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Build failed:\n" << e.what() << " "
+			<< e.err() << std::endl;
+		std::cerr << "BUILD LOG:\n" <<
+			img_prg.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
+			<< "\nLOG DONE\n";
+		return 1;
+	}
+
+	static const unsigned sizes[][2] = {
+		{ 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }, { 7680, 4320 },
+	};
+	const unsigned count = big ? 4 : 3;
+	const cl::ImageFormat format(CL_RGBA, CL_FLOAT);
+	unsigned errors = 0;
+	uint64_t seed = 0x4f1bbcdcbfa53e0bULL;
+	for (unsigned s = 0; s < count; ++s) {
+		const unsigned width = sizes[s][0], height = sizes[s][1];
+		const size_t pixels = (size_t)width * height;
+		const size_t bytes = pixels * 4 * sizeof(float);
+		/* three buffers and three images */
+		if (!frames_fit(devices[0], pixels, 6, 3)) {
+			std::cout << width << "x" << height
+				<< ": not enough memory, skipped" << std::endl;
+			continue;
+		}
+		std::vector<float> in, aux, results(pixels * 4);
+		random_frames(in, aux, pixels, seed, s);
+
+		double buffer_time, image_time;
+		try {
+			cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+			cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &in[0]);
+			cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &aux[0]);
+			cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+			cl::Kernel kernel(prg, "cl_weighted_blend");
+			kernel.setArg(0, in1);
+			kernel.setArg(1, in2);
+			kernel.setArg(2, out);
+			buffer_time = bench::best_time(cmd, kernel, cl::NDRange(pixels),
+			                               cl::NullRange, IMAGE_RUNS);
+
+			cl::Image2D img_in = bench::image2d(ctx,
+				CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				format, width, height, &in[0]);
+			cl::Image2D img_aux = bench::image2d(ctx,
+				CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				format, width, height, &aux[0]);
+			cl::Image2D img_out = bench::image2d(ctx, CL_MEM_WRITE_ONLY,
+				format, width, height);
+			cl::Kernel img_kernel(img_prg, "cl_weighted_blend_image");
+			img_kernel.setArg(0, img_in);
+			img_kernel.setArg(1, img_aux);
+			img_kernel.setArg(2, img_out);
+			image_time = bench::best_time(cmd, img_kernel,
+				cl::NDRange(width, height), cl::NullRange, IMAGE_RUNS);
+
+			cl::size_t<3> origin, region;
+			origin[0] = origin[1] = origin[2] = 0;
+			region[0] = width;
+			region[1] = height;
+			region[2] = 1;
+			cmd.enqueueReadImage(img_out, true, origin, region, 0, 0,
+				&results[0]);
+		} catch (cl::Error e) {
+			std::cerr << width << "x" << height << " failed: "
+				<< e.what() << " " << e.err() << std::endl;
+			return 1;
+		}
+		const std::string size = std::to_string(width) + "x" +
+			std::to_string(height);
+		bench::report(size + " buffer", pixels, buffer_time, 3 * bytes);
+		bench::report(size + " image", pixels, image_time, 3 * bytes);
+		std::cout << "\timage/buffer speedup: " << buffer_time / image_time
+			<< std::endl;
+		errors += verify_frame(s, &in[0], &aux[0], &results[0], pixels);
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
+/* Compares cl_weighted_blend_layers with layers - 1 chained
+ * cl_weighted_blend passes for 2 to MAX_LAYERS layers, as many as fit
+ * the device. The chain reads the layers through sub-buffers of the same
+ * layered buffer and ping pongs between two accumulators. Every pass may
+ * round differently, so the tolerance grows with the number of layers. */
+static int run_layers(const cl::Context &ctx,
+                      const cl::vector<cl::Device> &devices,
+                      const cl::Program &prg, unsigned width, unsigned height)
+{
+	static const unsigned layer_counts[] = { 2, 3, 4, 6, 8, 12, 16 };
+	const size_t pixels = (size_t)width * height;
+	const size_t bytes = pixels * 4 * sizeof(float);
+	/* sub-buffer origins have to be aligned to the base address
+	 * alignment, given in bits */
+	const size_t align = std::max<size_t>(4 * sizeof(float),
+		devices[0].getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8);
+	const size_t stride = bench::round_up(bytes, align);
+	/* the layered buffer holds every layer, the accumulators and the
+	 * output are three more frames */
+	const cl_ulong max_alloc =
+		devices[0].getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+	const size_t frames = bench::fit_elements(devices[0], MAX_LAYERS + 3,
+	                                          stride, 0, stride);
+	const unsigned max_layers = (unsigned)std::min<cl_ulong>(
+		std::min<cl_ulong>(frames > 3 ? frames - 3 : 0, max_alloc / stride),
+		MAX_LAYERS) & ~1u;
+	std::cout << "Compositing " << width << "x" << height << " layers"
+		<< std::endl;
+	if (max_layers < 2) {
+		std::cout << "\tnot enough device memory for two layers, skipped"
+			<< std::endl;
+		return 0;
+	}
+	if (max_layers < MAX_LAYERS)
+		std::cout << "\tdevice memory fits " << max_layers << " layers"
+			<< std::endl;
+
+	std::vector<float> layers(max_layers * stride / sizeof(float));
+	std::vector<float> fused(pixels * 4), chained(pixels * 4);
+	uint64_t seed = 0x3c6ef372fe94f82bULL;
+	for (unsigned l = 0; l < max_layers; l += 2) {
+		std::vector<float> in, aux;
+		random_frames(in, aux, pixels, seed, l);
+		std::copy(in.begin(), in.end(),
+		          layers.begin() + l * stride / sizeof(float));
+		std::copy(aux.begin(), aux.end(),
+		          layers.begin() + (l + 1) * stride / sizeof(float));
+	}
+
+	unsigned errors = 0;
+	try {
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		cl::Buffer layered = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			max_layers * stride, &layers[0]);
+		cl::Buffer layer[MAX_LAYERS];
+		for (unsigned l = 0; l < max_layers; ++l) {
+			const cl_buffer_region region = { l * stride, bytes };
+			layer[l] = layered.createSubBuffer(CL_MEM_READ_ONLY,
+				CL_BUFFER_CREATE_TYPE_REGION, &region);
+		}
+		cl::Buffer acc[2] = {
+			bench::buffer(ctx, CL_MEM_READ_WRITE, bytes),
+			bench::buffer(ctx, CL_MEM_READ_WRITE, bytes),
+		};
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, bytes);
+		cl::Kernel fuse(prg, "cl_weighted_blend_layers");
+		cl::Kernel blend(prg, "cl_weighted_blend");
+
+		for (unsigned count : layer_counts) {
+			if (count > max_layers)
+				break;
+			fuse.setArg(0, layered);
+			fuse.setArg(1, out);
+			fuse.setArg(2, count);
+			fuse.setArg(3, (unsigned)(stride / (4 * sizeof(float))));
+			double fused_time = 0, chained_time = 0;
+			fused_time = bench::best_time(cmd, fuse, cl::NDRange(pixels),
+			                              cl::NullRange, LAYER_RUNS);
+			cmd.enqueueReadBuffer(out, true, 0, bytes, &fused[0]);
+
+			unsigned last = 0;
+			for (unsigned r = 0; r < LAYER_RUNS; ++r) {
+				double t = 0;
+				for (unsigned l = 1; l < count; ++l) {
+					cl::Event ev;
+					last = l % 2;
+					blend.setArg(0, l == 1 ? layer[0] : acc[(l + 1) % 2]);
+					blend.setArg(1, layer[l]);
+					blend.setArg(2, acc[last]);
+					cmd.enqueueNDRangeKernel(blend, cl::NullRange,
+						cl::NDRange(pixels), cl::NullRange,
+						NULL, &ev);
+					ev.wait();
+					t += bench::event_seconds(ev);
+				}
+				chained_time = r == 0 ? t : std::min(chained_time, t);
+			}
+			cmd.enqueueReadBuffer(acc[last], true, 0, bytes, &chained[0]);
+
+			const std::string what = std::to_string(count) + " layers ";
+			bench::report(what + "fused", pixels, fused_time,
+				(count + 1) * bytes);
+			bench::report(what + "chained", pixels, chained_time,
+				3 * (count - 1) * bytes);
+			std::cout << "\tfused speedup: " << chained_time / fused_time
+				<< std::endl;
+
+			const float tolerance = STREAM_TOLERANCE * count;
+			unsigned wrong = 0;
+			bench::parallel_for(pixels * 4, [&](size_t begin, size_t end) {
+				unsigned local_errors = 0;
+				for (size_t i = begin; i < end; ++i)
+					local_errors += !(std::fabs(fused[i] - chained[i]) <=
+						tolerance * std::max(1.0f, std::fabs(chained[i])));
+				std::lock_guard<std::mutex> guard(bench::log_lock());
+				wrong += local_errors;
+			});
+			std::cout << "\tfused vs chained over tolerance " << tolerance
+				<< ": " << wrong << "/" << pixels * 4 << std::endl;
+			errors += wrong;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Layers failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+	return errors ? 1 : 0;
+}
+
+/* Work-group shapes for the 2D kernels, 256x1 is plain row-major */
+static const unsigned tile_shapes[][2] = {
+	{ 256, 1 }, { 128, 2 }, { 64, 4 }, { 32, 8 }, { 16, 16 }, { 8, 32 },
 };
 
+/* Runs cl_weighted_blend_2d on a pitched frame for every tile shape.
+ * The flat 1D kernel over the same padded frame is the baseline. The
+ * padding of the output is filled with a sentinel that has to survive. */
+static int run_tiled(const cl::Context &ctx,
+                     const cl::vector<cl::Device> &devices,
+                     const cl::Program &prg, unsigned width, unsigned height)
+{
+	const unsigned pitch = width + PITCH_PAD;
+	const size_t padded = (size_t)pitch * height;
+	const size_t bytes = padded * 4 * sizeof(float);
+	/* only the visible pixels count */
+	const size_t pixels = (size_t)width * height;
+	const size_t moved = 3 * pixels * 4 * sizeof(float);
+	std::cout << "Tiled " << width << "x" << height << " pitch " << pitch
+		<< std::endl;
+
+	std::vector<float> in, aux, results(padded * 4);
+	uint64_t seed = 0x510e527fade682d1ULL;
+	random_frames(in, aux, padded, seed, 0);
+	const std::vector<float> sentinel(padded * 4, -1.0f);
+
+	unsigned errors = 0;
+	try {
+		cl::CommandQueue cmd(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+		cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &in[0]);
+		cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &aux[0]);
+		cl::Buffer out = bench::buffer(ctx, CL_MEM_READ_WRITE, bytes);
+
+		cl::Kernel flat(prg, "cl_weighted_blend");
+		flat.setArg(0, in1);
+		flat.setArg(1, in2);
+		flat.setArg(2, out);
+		bench::report("1D flat (incl. padding)", pixels,
+			bench::best_time(cmd, flat, cl::NDRange(padded),
+			                 cl::NullRange, TILE_RUNS),
+			moved);
+
+		cl::Kernel kernel(prg, "cl_weighted_blend_2d");
+		kernel.setArg(0, in1);
+		kernel.setArg(1, in2);
+		kernel.setArg(2, out);
+		kernel.setArg(3, (int)width);
+		kernel.setArg(4, (int)height);
+		kernel.setArg(5, (int)pitch);
+		const size_t max_group =
+			kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]);
+		for (unsigned t = 0; t < sizeof(tile_shapes) / sizeof(tile_shapes[0]); ++t) {
+			const unsigned tx = tile_shapes[t][0], ty = tile_shapes[t][1];
+			const std::string what = "2D " + std::to_string(tx) +
+				"x" + std::to_string(ty);
+			if (tx * ty > max_group) {
+				std::cout << what << ": skipped, work-group too large"
+					<< std::endl;
+				continue;
+			}
+			cmd.enqueueWriteBuffer(out, true, 0, bytes, &sentinel[0]);
+			const cl::NDRange global(bench::round_up(width, tx),
+			                         bench::round_up(height, ty));
+			const double best = bench::best_time(cmd, kernel, global,
+				cl::NDRange(tx, ty), TILE_RUNS);
+			cmd.enqueueReadBuffer(out, true, 0, bytes, &results[0]);
+			bench::report(what, pixels, best, moved);
+
+			unsigned wrong = 0;
+			bench::parallel_for(height, [&](size_t begin, size_t end) {
+				unsigned local_errors = 0;
+				for (size_t y = begin; y < end; ++y) {
+					const size_t row = y * pitch;
+					float res[4];
+					for (size_t x = 0; x < width; ++x) {
+						const size_t i = (row + x) * 4;
+						local_errors += !blend_ok(&in[i],
+							&aux[i], &results[i], res);
+					}
+					for (size_t x = width; x < pitch; ++x)
+						for (unsigned c = 0; c < 4; ++c)
+							local_errors +=
+								results[(row + x) * 4 + c] != -1.0f;
+				}
+				std::lock_guard<std::mutex> guard(bench::log_lock());
+				wrong += local_errors;
+			});
+			if (wrong)
+				std::cout << "Wrong " << what << ": " << wrong
+					<< std::endl;
+			errors += wrong;
+		}
+	} catch (cl::Error e) {
+		std::cerr << "Tiled failed: " << e.what() << " "
+			<< e.err() << std::endl;
+		return 1;
+	}
+	std::cout << "Wrong: " << errors << std::endl;
+	return errors ? 1 : 0;
+}
+
 int main(int argc, const char*argv[])
 {
+	bench::memory_reporter memory;
+	/* --stream [--bench] [--8k] [--frames=n] selects frame stream mode,
+	 * --precision [--8k] compares pixel storage formats,
+	 * --image [--8k] compares buffers and images at several sizes,
+	 * --layers compares fused and chained compositing of 1080p layers,
+	 * --tiled [--8k] compares 2D work-group shapes on a pitched frame,
+	 * default is the small fixed-value check. */
+	bool stream = false, bench_mode = false, precision = false;
+	bool image = false, layers = false, tiled = false;
+	unsigned width = 3840, height = 2160, frames = 120;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg(argv[i]);
+		if (arg == "--stream")
+			stream = true;
+		else if (arg == "--image")
+			image = true;
+		else if (arg == "--layers")
+			layers = true;
+		else if (arg == "--tiled")
+			tiled = true;
+		else if (arg == "--precision")
+			precision = true;
+		else if (arg == "--bench")
+			bench_mode = true;
+		else if (arg == "--8k") {
+			width = 7680;
+			height = 4320;
+		} else if (arg.compare(0, 9, "--frames=") == 0)
+			frames = std::max(1, atoi(arg.c_str() + 9));
+		else {
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return 1;
+		}
+	}
+
 	float in[DATA_SIZE];       // original data set given to device
 	float aux[DATA_SIZE];       // original data set given to device
 	float results[DATA_SIZE];    // results returned from device
@@ -52,6 +899,7 @@ int main(int argc, const char*argv[])
 		aux[i+3] = 0.5;
 	}
 
+	bench::trace::phase("platform");
 	cl::vector< cl::Platform > platformList;
 	cl::Platform::get(&platformList);
 	std::cout << "Platform count is: " << platformList.size() << std::endl;
@@ -79,19 +927,21 @@ int main(int argc, const char*argv[])
 	std::cout << "Platform is `" << name << "' by: " << vendor
 		<< " version: " << version << std::endl;
 
+	bench::trace::phase("context");
 	/* Create CL context */
 	cl::Context ctx(devices);
 
 	/* CL buffers to use as kernel arguments */
-	cl::Buffer in1(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(in), in);
-	cl::Buffer in2(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(aux), aux);
-	cl::Buffer out(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
+	cl::Buffer in1 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(in), in);
+	cl::Buffer in2 = bench::buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(aux), aux);
+	cl::Buffer out = bench::buffer(ctx, CL_MEM_WRITE_ONLY, sizeof(results));
 
+	bench::trace::phase("build");
 	/* Create program from source */
-	cl::Program::Sources src(1, std::make_pair(kernelSource, std::strlen(kernelSource)));
+	const cl::Program::Sources src = blend_sources(kernelSource);
 	cl::Program prg(ctx, src);
 	try {
-		int ret = prg.build(devices);
+		int ret = bench::build(prg, ctx, devices, bench::build_options());
 		if (ret != CL_SUCCESS) {
 			std::cout <<"BUILD FAIL" << std::endl;
 		}
@@ -106,6 +956,19 @@ int main(int argc, const char*argv[])
 		return 1;
 	}
 
+	bench::trace::phase("run");
+	if (tiled)
+		return run_tiled(ctx, devices, prg, width, height);
+	if (layers)
+		return run_layers(ctx, devices, prg, 1920, 1080);
+	if (image)
+		return run_image(ctx, devices, prg, width == 7680);
+	if (precision)
+		return run_precision(ctx, devices, width, height);
+	if (stream)
+		return run_stream(ctx, devices[0], prg, width, height, frames,
+		                  bench_mode);
+
 	/* Create kernel and set arguments */
 	try {
 		cl::Kernel kernel(prg, "cl_weighted_blend");